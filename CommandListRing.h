@@ -0,0 +1,227 @@
+#pragma once
+
+#include "Function.h"
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// reusable command list slots of one queue.
+// acquire() hands out a free item together with a submission ticket, tickets follow the order of the acquire calls.
+// recording threads publish() in whatever order they finish, consume() visits the items in ticket order.
+// free items live in a bounded lock-free MPMC ring, new items are only created when it runs dry.
+// consume() is the frame boundary and must not overlap acquire() or publish(), every acquired item has to be published by then.
+template<class T>
+class CommandListRing
+{
+public:
+	using Factory = UniqueFunction<T*(size_t index)>;
+
+	struct Slot
+	{
+		T* item = nullptr;
+		size_t ticket = 0;
+	};
+
+	static const size_t CHUNK_SIZE = 64;
+	static const size_t MAX_CHUNKS = 4096;
+
+	CommandListRing(size_t capacity, Factory&& factory):
+		mFactory(std::move(factory)),
+		mFree(new FreeRing(capacity)),
+		mChunks(new std::atomic<std::atomic<T*>*>[MAX_CHUNKS])
+	{
+		for (size_t i = 0; i < MAX_CHUNKS; ++i)
+			mChunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	~CommandListRing()
+	{
+		for (size_t i = 0; i < MAX_CHUNKS; ++i)
+			delete[] mChunks[i].load(std::memory_order_relaxed);
+	}
+
+	Slot acquire()
+	{
+		Slot slot;
+		if (!mFree->pop(slot.item))
+			slot.item = create();
+
+		slot.ticket = mNextTicket.fetch_add(1, std::memory_order_relaxed);
+		// checked in release builds too, the ticket would index past the chunk table
+		if (slot.ticket >= CHUNK_SIZE * MAX_CHUNKS)
+		{
+			fprintf(stderr, "more than %zu command lists in one frame\n", CHUNK_SIZE * MAX_CHUNKS);
+			std::terminate();
+		}
+		prepareChunk(slot.ticket / CHUNK_SIZE);
+		return slot;
+	}
+
+	void publish(const Slot& slot)
+	{
+		entry(slot.ticket).store(slot.item, std::memory_order_release);
+	}
+
+	// calls f(item) for every acquired item in ticket order and recycles them, returns the count
+	template<class F>
+	size_t consume(F&& f)
+	{
+		auto count = mNextTicket.exchange(0, std::memory_order_acquire);
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto& e = entry(i);
+			auto item = e.load(std::memory_order_acquire);
+			// checked in release builds too, skipping it would submit the frame without its commands
+			if (item == nullptr)
+			{
+				fprintf(stderr, "command list %zu is consumed before it is published\n", i);
+				std::terminate();
+			}
+			f(item);
+			e.store(nullptr, std::memory_order_relaxed);
+			recycle(item);
+		}
+		return count;
+	}
+
+	// tickets handed out since the last consume(), exact only on the thread that acquires
+	size_t getNumAcquired()const
+	{
+		return mNextTicket.load(std::memory_order_relaxed);
+	}
+
+	size_t getNumItems()const
+	{
+		std::lock_guard<std::mutex> lock(mCreateMutex);
+		return mItems.size();
+	}
+
+private:
+	// Vyukov's bounded queue, every cell carries a sequence number telling whose turn it is
+	class FreeRing
+	{
+	public:
+		FreeRing(size_t capacity)
+		{
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+			mMask = size - 1;
+			mCells.reset(new Cell[size]);
+			for (size_t i = 0; i < size; ++i)
+				mCells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		bool push(T* item)
+		{
+			auto pos = mEnqueue.load(std::memory_order_relaxed);
+			while (true)
+			{
+				auto& cell = mCells[pos & mMask];
+				auto seq = cell.sequence.load(std::memory_order_acquire);
+				auto diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (mEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						cell.item = item;
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = mEnqueue.load(std::memory_order_relaxed);
+			}
+		}
+
+		bool pop(T*& item)
+		{
+			auto pos = mDequeue.load(std::memory_order_relaxed);
+			while (true)
+			{
+				auto& cell = mCells[pos & mMask];
+				auto seq = cell.sequence.load(std::memory_order_acquire);
+				auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0)
+				{
+					if (mDequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						item = cell.item;
+						cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = mDequeue.load(std::memory_order_relaxed);
+			}
+		}
+
+		size_t capacity()const { return mMask + 1; }
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			T* item = nullptr;
+		};
+
+		std::unique_ptr<Cell[]> mCells;
+		size_t mMask;
+		alignas(64) std::atomic<size_t> mEnqueue = 0;
+		alignas(64) std::atomic<size_t> mDequeue = 0;
+	};
+
+	T* create()
+	{
+		std::lock_guard<std::mutex> lock(mCreateMutex);
+		mItems.emplace_back(mFactory(mItems.size()));
+		return mItems.back().get();
+	}
+
+	void recycle(T* item)
+	{
+		if (mFree->push(item))
+			return;
+		// more items than the ring holds, nobody else touches it during consume()
+		std::unique_ptr<FreeRing> grown(new FreeRing(mFree->capacity() * 2));
+		T* i = nullptr;
+		while (mFree->pop(i))
+			grown->push(i);
+		grown->push(item);
+		mFree = std::move(grown);
+	}
+
+	void prepareChunk(size_t index)
+	{
+		if (mChunks[index].load(std::memory_order_acquire))
+			return;
+		std::lock_guard<std::mutex> lock(mCreateMutex);
+		if (mChunks[index].load(std::memory_order_relaxed))
+			return;
+		auto chunk = new std::atomic<T*>[CHUNK_SIZE];
+		for (size_t i = 0; i < CHUNK_SIZE; ++i)
+			chunk[i].store(nullptr, std::memory_order_relaxed);
+		mChunks[index].store(chunk, std::memory_order_release);
+	}
+
+	std::atomic<T*>& entry(size_t ticket)
+	{
+		return mChunks[ticket / CHUNK_SIZE].load(std::memory_order_acquire)[ticket % CHUNK_SIZE];
+	}
+
+private:
+	Factory mFactory;
+	mutable std::mutex mCreateMutex;
+	std::vector<std::unique_ptr<T>> mItems;
+	std::unique_ptr<FreeRing> mFree;
+
+	std::atomic<size_t> mNextTicket = 0;
+	// published items by ticket, chunks are kept across frames
+	std::unique_ptr<std::atomic<std::atomic<T*>*>[]> mChunks;
+};
@@ -2,6 +2,10 @@
 
 #include <coroutine>
 #include <functional>
+#include "FrameArena.h"
+#include "Function.h"
+
+class WaitList;
 
 template<class Promise>
 class Future
@@ -22,8 +26,34 @@ public:
 	inline Future<Promise> get_return_object(){return Future(std::coroutine_handle<Promise>::from_promise(*this));};
 	constexpr std::suspend_never initial_suspend()noexcept { return {}; }
 	constexpr std::suspend_always final_suspend() noexcept { return {}; }
-	inline void unhandled_exception() { throw std::exception("unhandled_exception in coroutine"); }
+	inline void unhandled_exception() { throw; }
 	inline void return_void() {}
+
+	// coroutine frames come from the per-frame arena
+	static void* operator new(size_t size) { return FrameArena::Singleton.alloc(size); }
+	static void operator delete(void* ptr) { FrameArena::Singleton.dealloc(ptr); }
+
+	// left by an awaitable that was not ready, whoever drives the coroutine parks it on the list
+	// instead of resuming it again
+	struct Park
+	{
+		WaitList* list = nullptr;
+		UniqueFunction<bool()> ready;
+
+		explicit operator bool()const { return list != nullptr; }
+	};
+
+	Park takePark()
+	{
+		Park park = std::move(mPark);
+		mPark = {};
+		return park;
+	}
+	bool isParked()const { return !!mPark; }
+private:
+	friend class WaitList;
+	template<class> friend class Coroutine;
+	Park mPark;
 };
 
 
@@ -32,7 +62,17 @@ template<class promise_type = Promise>
 class Coroutine
 {
 public:
-	using Future = Future<promise_type>;
+	using Future = ::Future<promise_type>;
+
+	// awaited by a coroutine that resumes this one by hand, the outer one takes over
+	// whatever this one is parked on, so both are resumed once it is signalled
+	struct Yield
+	{
+		Promise& inner;
+		bool await_ready()const { return false; }
+		void await_suspend(std::coroutine_handle<Promise> outer) { outer.promise().mPark = inner.takePark(); }
+		void await_resume()const {}
+	};
 
 	Coroutine(const Coroutine&) = delete;
 	void operator=(const Coroutine&) = delete;
@@ -47,7 +87,7 @@ public:
 	{
 	}
 
-	Coroutine(Coroutine&& co)
+	Coroutine(Coroutine&& co) noexcept
 	{
 		*this = std::move(co);
 	}
@@ -60,7 +100,7 @@ public:
 		}
 	}
 
-	Coroutine& operator = (Coroutine&& co)
+	Coroutine& operator = (Coroutine&& co) noexcept
 	{
 		mFuture = co.mFuture;
 		co.mFuture = {};
@@ -87,6 +127,11 @@ public:
 	{
 		return mFuture.getHandle().promise();
 	}
+
+	Yield yield()const
+	{
+		return { getPromise() };
+	}
 private:
 	Future mFuture;
 };
\ No newline at end of file
@@ -1,33 +1,175 @@
 #include "Dispatcher.h"
+#include <thread>
+#include <cstdio>
+#include <exception>
+
+#if !defined(_HEADLESS)
+// priority lanes of a plain asio context.
+// every job posts one token to the context, a token runs the most urgent job queued at that time.
+class Dispatcher::LaneService : public asio::execution_context::service
+{
+public:
+	static asio::execution_context::id id;
+
+	LaneService(asio::execution_context& context):
+		asio::execution_context::service(context)
+	{
+	}
+
+	void push(Scheduler::Job* job, DispatchPriority priority)
+	{
+		mLanes[priority].push(job);
+	}
+
+	void runOne()
+	{
+		if (auto job = pop())
+		{
+			std::unique_ptr<Scheduler::Job> holder(job);
+			holder->run();
+		}
+	}
+
+private:
+	void shutdown() override
+	{
+	}
+
+	Scheduler::Job* pop()
+	{
+		if (auto job = mLanes[DP_CRITICAL].pop())
+			return job;
+		if (mTicks.fetch_add(1, std::memory_order_relaxed) % Scheduler::BACKGROUND_INTERVAL == 0)
+		{
+			if (auto job = mLanes[DP_BACKGROUND].pop())
+				return job;
+		}
+		if (auto job = mLanes[DP_NORMAL].pop())
+			return job;
+		return mLanes[DP_BACKGROUND].pop();
+	}
+
+	Scheduler::Lane mLanes[DP_COUNT];
+	std::atomic<uint32_t> mTicks = 1;
+};
+
+asio::execution_context::id Dispatcher::LaneService::id;
+#endif
 
 asio::io_context Dispatcher::sharedContext;
+Scheduler::Ptr Dispatcher::sharedScheduler;
+
+#if defined(_HEADLESS)
+Dispatcher::Dispatcher(asio::io_context& context, DispatchPriority priority):
+	mContext(context), mPriority(priority)
+{
+	if (&context != &sharedContext || !sharedScheduler)
+	{
+		fprintf(stderr, "headless dispatchers need the shared context with work stealing enabled\n");
+		std::terminate();
+	}
+	mScheduler = sharedScheduler;
+	mSchedulerStrand = std::make_unique<Scheduler::Strand>(*mScheduler, priority);
+}
+#else
+Dispatcher::Dispatcher(asio::io_context& context, DispatchPriority priority):
+	mContext(context), mPriority(priority), mStrand(context), mWork(context)
+{
+	if (&context == &sharedContext && sharedScheduler)
+	{
+		mScheduler = sharedScheduler;
+		mSchedulerStrand = std::make_unique<Scheduler::Strand>(*mScheduler, priority);
+	}
+	else
+		mLanes = &asio::use_service<LaneService>(context);
+}
 
-Dispatcher::Dispatcher(asio::io_context& context):
-	mContext(context), mStrand(context), mWork(context)
+void Dispatcher::postToLane(Scheduler::Job* job, DispatchPriority priority)
 {
+	mLanes->push(job, priority);
+	asio::post(mContext, [lanes = mLanes]() {
+		lanes->runOne();
+	});
 }
+#endif
 
 Dispatcher::~Dispatcher()
 {
 }
 
+bool Dispatcher::poll_one()
+{
+#if defined(_HEADLESS)
+	return mScheduler->poll_one();
+#else
+	if (mScheduler)
+		return mScheduler->poll_one();
+	else
+		return mContext.poll_one() != 0;
+#endif
+}
+
+void Dispatcher::poll()
+{
+#if defined(_HEADLESS)
+	while (mScheduler->poll_one());
+#else
+	if (mScheduler)
+	{
+		while (mScheduler->poll_one());
+	}
+	else
+		mContext.poll();
+#endif
+}
 
+size_t Dispatcher::getConcurrency()const
+{
+	if (mScheduler)
+		return std::max<size_t>(mScheduler->getNumWorkers(), 1);
+	return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
 
 void Dispatcher::poll_one(bool block)
 {
-	if (block)
+	if (sharedScheduler)
+		sharedScheduler->poll_one(block);
+#if !defined(_HEADLESS)
+	else if (block)
 		sharedContext.run_one();
 	else
 		sharedContext.poll_one();
+#endif
 }
 
+#if !defined(_HEADLESS)
 void Dispatcher::run(asio::io_context& c)
 {
 	asio::io_context::work work(c);
 	c.run();
 }
+#endif
 
 void Dispatcher::stop(asio::io_context& c )
 {
+	if (&c == &sharedContext && sharedScheduler)
+		sharedScheduler->stop();
+#if !defined(_HEADLESS)
 	c.stop();
+#endif
+}
+
+void Dispatcher::enableWorkStealing(size_t numWorkers)
+{
+	sharedScheduler = std::make_shared<Scheduler>(numWorkers);
+}
+
+void Dispatcher::runWorker(size_t index)
+{
+	if (sharedScheduler)
+		sharedScheduler->run(index);
+#if !defined(_HEADLESS)
+	else
+		run(sharedContext);
+#endif
 }
@@ -1,51 +1,117 @@
 #pragma once
 
+#include "Scheduler.h"
+#if defined(_HEADLESS)
+// headless builds come without asio, every dispatcher runs on the work-stealing scheduler
+namespace asio
+{
+	class io_context {};
+}
+#else
 #define ASIO_STANDALONE
-#include "Common.h"
 #include "asio.hpp"
 #include "asio/strand.hpp"
+#endif
 
 
 class Dispatcher
 {
 public:
 public:
-	Dispatcher(asio::io_context& context = sharedContext);
+	// priority is the lane of invoke(), execute() and of the strand
+	Dispatcher(asio::io_context& context = sharedContext, DispatchPriority priority = DP_NORMAL);
 	
 	~Dispatcher();
 	template<class Handler>
 	void invoke(Handler&& handler)
 	{
-		mContext.post(std::move(handler));
+		invoke(std::move(handler), mPriority);
+	}
+
+	template<class Handler>
+	void invoke(Handler&& handler, DispatchPriority priority)
+	{
+		if (mScheduler)
+			mScheduler->post(std::move(handler), priority);
+#if !defined(_HEADLESS)
+		else
+			postToLane(new Scheduler::Job(std::move(handler)), priority);
+#endif
 	}
 
+	// asio strands keep plain FIFO order, only the scheduler strand honours the priority
 	template<class Handler>
 	void invoke_strand(Handler&& handler)
 	{
-		mStrand.post(std::move(handler));
+		if (mSchedulerStrand)
+			mSchedulerStrand->post(std::move(handler));
+#if !defined(_HEADLESS)
+		else
+			asio::post(mStrand, std::move(handler));
+#endif
 	}
 
 	template<class Handler>
 	void execute(Handler&& handler)
 	{
-		mContext.dispatch(std::move(handler));
+		if (mScheduler && mScheduler->isWorkerThread())
+			handler();
+		else if (mScheduler)
+			mScheduler->post(std::move(handler), mPriority);
+#if !defined(_HEADLESS)
+		else if (mContext.get_executor().running_in_this_thread())
+			handler();
+		else
+			postToLane(new Scheduler::Job(std::move(handler)), mPriority);
+#endif
 	}
 
 	template<class Handler>
 	void execute_strand(Handler&& handler)
 	{
-		mStrand.dispatch(std::move(handler));
+		if (mSchedulerStrand)
+			mSchedulerStrand->post(std::move(handler));
+#if !defined(_HEADLESS)
+		else
+			asio::dispatch(mStrand, std::move(handler));
+#endif
 	}
 
+	// runs one pending handler of this dispatcher on the calling thread
+	bool poll_one();
+	void poll();
+	// true if handlers are guaranteed to make progress without the calling thread polling
+	bool hasWorkers()const { return mScheduler && mScheduler->getNumWorkers() > 0; }
+	// number of threads expected to run handlers, asio contexts are assumed to be run by every core
+	size_t getConcurrency()const;
+	DispatchPriority getPriority()const { return mPriority; }
+
 	static void poll_one(bool block);
+#if !defined(_HEADLESS)
 	static void run(asio::io_context& context);
+#endif
 	static void stop(asio::io_context& context);
 
+	// replaces the shared context with a work-stealing scheduler.
+	// must be called before any dispatcher on the shared context is created.
+	static void enableWorkStealing(size_t numWorkers);
+	static void runWorker(size_t index);
+
 	static asio::io_context& getSharedContext(){return sharedContext;}
+	static Scheduler::Ptr getSharedScheduler(){return sharedScheduler;}
 private:
 	static asio::io_context sharedContext;
+	static Scheduler::Ptr sharedScheduler;
 	asio::io_context& mContext = sharedContext;
+	DispatchPriority mPriority = DP_NORMAL;
+#if !defined(_HEADLESS)
+	class LaneService;
+	void postToLane(Scheduler::Job* job, DispatchPriority priority);
+
+	LaneService* mLanes = nullptr;
 	asio::io_context::strand mStrand;
 	asio::io_context::work mWork;
-
-};
\ No newline at end of file
+#endif
+	Scheduler::Ptr mScheduler;
+	std::unique_ptr<Scheduler::Strand> mSchedulerStrand;
+};
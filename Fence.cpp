@@ -1,14 +1,47 @@
 #include "Fence.h"
 
+void WaitList::park(Continuation&& c, const Ready& ready)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!ready())
+		{
+			mWaiters.emplace_back(std::move(c));
+			return;
+		}
+	}
+	c();
+}
+
+void WaitList::notify()
+{
+	std::vector<Continuation> waiters;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		waiters.swap(mWaiters);
+	}
+	for (auto& c : waiters)
+		c();
+}
+
+void WaitList::suspend(Promise& promise, Ready&& ready)
+{
+	// ready() is checked again when the task parks, a signal in between is not lost
+	promise.mPark = { this, std::move(ready) };
+}
 
 
 void FenceObject::signal(std::function<void()>&& dosomething)
 {
-	std::lock_guard<std::mutex> lock(mMutex);
-	if (dosomething)
-		dosomething();
-	mCond.store(true, std::memory_order_relaxed);
-	mCondVar.notify_one();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (dosomething)
+			dosomething();
+		mCond.store(true, std::memory_order_release);
+		mSignalled.store(true, std::memory_order_release);
+		mCondVar.notify_one();
+	}
+	mWaiters.notify();
 }
 
 bool FenceObject::wait(std::function<bool()>&& cond ,bool block )
@@ -37,3 +70,29 @@ bool FenceObject::wait(std::function<bool()>&& cond ,bool block )
 	}
 	return true;
 }
+
+void FenceObject::Awaiter::await_suspend(std::coroutine_handle<Promise> h)
+{
+	fence->mWaiters.suspend(h.promise(), [fence = fence]() {
+		return fence->mSignalled.load(std::memory_order_acquire);
+	});
+}
+
+
+void AwaitableFlag::set()
+{
+	mValue.store(true, std::memory_order_release);
+	mWaiters.notify();
+}
+
+void AwaitableFlag::reset()
+{
+	mValue.store(false, std::memory_order_release);
+}
+
+void AwaitableFlag::Awaiter::await_suspend(std::coroutine_handle<Promise> h)
+{
+	flag->mWaiters.suspend(h.promise(), [flag = flag]() {
+		return flag->isSet();
+	});
+}
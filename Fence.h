@@ -1,18 +1,80 @@
 #pragma once
 
-#include "Common.h"
+#include "Function.h"
+#include "Coroutine.h"
 #include <mutex>
 #include <atomic>
+#include <vector>
+#include <memory>
+#include <coroutine>
+#include <condition_variable>
+
+// continuations parked on a signal, each one runs exactly once
+class WaitList
+{
+public:
+	using Continuation = UniqueFunction<void()>;
+	using Ready = UniqueFunction<bool()>;
+
+	// keeps the continuation until notify(), runs it immediately if ready() already holds
+	void park(Continuation&& c, const Ready& ready);
+	void notify();
+
+	// await_suspend helper, leaves the wait in the promise of the suspended coroutine.
+	// the executor task driving it parks itself here and resumes it once, after notify().
+	void suspend(Promise& promise, Ready&& ready);
+private:
+	std::mutex mMutex;
+	std::vector<Continuation> mWaiters;
+};
 
 class FenceObject
 {
 public:
 	using Ptr = std::shared_ptr<FenceObject>;
 
+	struct Awaiter
+	{
+		FenceObject* fence;
+		bool await_ready()const { return fence->mSignalled.load(std::memory_order_acquire); }
+		void await_suspend(std::coroutine_handle<Promise> h);
+		void await_resume()const {}
+	};
+
 	void signal(std::function<void()>&& dosomething = {});
 	bool wait(std::function<bool()>&& cond = {}, bool block = true);
+
+	// ready once the fence has been signalled, whether or not wait() consumed the signal since
+	Awaiter operator co_await() { return { this }; }
 private:
 	std::mutex mMutex;
 	std::condition_variable mCondVar;
 	std::atomic_bool mCond = false;
-};
\ No newline at end of file
+	std::atomic_bool mSignalled = false;
+	WaitList mWaiters;
+};
+
+class AwaitableFlag
+{
+public:
+	using Ptr = std::shared_ptr<AwaitableFlag>;
+
+	struct Awaiter
+	{
+		AwaitableFlag* flag;
+		bool await_ready()const { return flag->isSet(); }
+		void await_suspend(std::coroutine_handle<Promise> h);
+		void await_resume()const {}
+	};
+
+	AwaitableFlag(bool v = false) : mValue(v) {}
+
+	void set();
+	void reset();
+	bool isSet()const { return mValue.load(std::memory_order_acquire); }
+
+	Awaiter operator co_await() { return { this }; }
+private:
+	std::atomic_bool mValue;
+	WaitList mWaiters;
+};
@@ -0,0 +1,110 @@
+#include "FrameArena.h"
+
+FrameArena FrameArena::Singleton;
+thread_local FrameArena::ThreadArena FrameArena::LocalArena;
+
+FrameArena::ThreadArena::~ThreadArena()
+{
+	if (current)
+		Singleton.release(current);
+	current = nullptr;
+}
+
+void* FrameArena::alloc(size_t size)
+{
+	auto total = (size + sizeof(Header) + 15) & ~(size_t)15;
+	if (total > BLOCK_SIZE)
+	{
+		mHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+		auto header = (Header*)::operator new(size + sizeof(Header));
+		header->block = nullptr;
+		return header + 1;
+	}
+
+	auto& arena = LocalArena;
+	auto frame = mFrame.load(std::memory_order_relaxed);
+	if (arena.current && (arena.frame != frame || arena.current->offset + total > BLOCK_SIZE))
+	{
+		release(arena.current);
+		arena.current = nullptr;
+	}
+
+	if (!arena.current)
+	{
+		arena.current = acquireBlock();
+		arena.frame = frame;
+	}
+
+	auto block = arena.current;
+	block->refs.fetch_add(1, std::memory_order_relaxed);
+	auto header = (Header*)(block->data + block->offset);
+	block->offset += total;
+	header->block = block;
+
+	mArenaAllocations.fetch_add(1, std::memory_order_relaxed);
+	mArenaBytes.fetch_add(total, std::memory_order_relaxed);
+	return header + 1;
+}
+
+void FrameArena::dealloc(void* ptr)
+{
+	if (!ptr)
+		return;
+
+	auto header = (Header*)ptr - 1;
+	if (header->block)
+		release(header->block);
+	else
+		::operator delete(header);
+}
+
+void FrameArena::nextFrame()
+{
+	mFrame.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mLastStats.arenaAllocations = mArenaAllocations.exchange(0, std::memory_order_relaxed);
+	mLastStats.heapAllocations = mHeapAllocations.exchange(0, std::memory_order_relaxed);
+	mLastStats.arenaBytes = mArenaBytes.exchange(0, std::memory_order_relaxed);
+	mLastStats.numBlocks = mNumBlocks;
+}
+
+FrameArena::Stats FrameArena::getStats()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLastStats;
+}
+
+FrameArena::Block* FrameArena::acquireBlock()
+{
+	Block* block = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mFreeBlocks)
+		{
+			block = mFreeBlocks;
+			mFreeBlocks = block->next;
+		}
+		else
+			mNumBlocks++;
+	}
+
+	if (!block)
+		block = new Block();
+
+	block->next = nullptr;
+	block->offset = 0;
+	// the owning thread holds one reference until it moves to another block
+	block->refs.store(1, std::memory_order_relaxed);
+	return block;
+}
+
+void FrameArena::release(Block* block)
+{
+	if (block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	block->next = mFreeBlocks;
+	mFreeBlocks = block;
+}
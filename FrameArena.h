@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+
+// per-thread bump allocator for short-lived allocations such as coroutine frames.
+// every thread allocates from its own block and switches to a fresh block each frame,
+// a block goes back to the pool once all of its allocations are freed,
+// so frames that outlive their frame keep their block alive instead of being overwritten.
+class FrameArena
+{
+public:
+	static FrameArena Singleton;
+
+	static const size_t BLOCK_SIZE = 64 * 1024;
+
+	struct Stats
+	{
+		size_t arenaAllocations = 0;
+		size_t heapAllocations = 0;
+		size_t arenaBytes = 0;
+		size_t numBlocks = 0;
+	};
+
+	void* alloc(size_t size);
+	void dealloc(void* ptr);
+
+	// called once per frame by the renderer
+	void nextFrame();
+	// counters of the last completed frame
+	Stats getStats();
+private:
+	struct Block
+	{
+		std::atomic<size_t> refs = 0;
+		size_t offset = 0;
+		Block* next = nullptr;
+		alignas(16) char data[BLOCK_SIZE];
+	};
+
+	struct Header
+	{
+		Block* block;
+		size_t padding;
+	};
+	static_assert(sizeof(Header) % 16 == 0, "header must keep 16 bytes alignment");
+
+	struct ThreadArena
+	{
+		Block* current = nullptr;
+		size_t frame = 0;
+		~ThreadArena();
+	};
+
+	Block* acquireBlock();
+	void release(Block* block);
+private:
+	static thread_local ThreadArena LocalArena;
+
+	std::atomic<size_t> mFrame = 0;
+	std::mutex mMutex;
+	Block* mFreeBlocks = nullptr;
+	size_t mNumBlocks = 0;
+
+	std::atomic<size_t> mArenaAllocations = 0;
+	std::atomic<size_t> mHeapAllocations = 0;
+	std::atomic<size_t> mArenaBytes = 0;
+	Stats mLastStats;
+};
@@ -3,6 +3,7 @@
 #include "Profile.h"
 #include "Dispatcher.h"
 #include "ImguiOverlay.h"
+#include "ThreadTopology.h"
 std::function<LRESULT(HWND, UINT, WPARAM, LPARAM)> Framework::processor;
 bool Framework::needPaint = true;
 
@@ -14,17 +15,23 @@ Framework::Framework()
 	createWindow();
 	mRenderer = Renderer::create();
 
+	auto& topology = ThreadTopology::Singleton;
 #ifndef _DEBUG
-	auto maxworkers = std::thread::hardware_concurrency() - 1;
+	auto layout = topology.plan(ThreadTopology::PP_PHYSICAL_CORES);
 #else
-	auto maxworkers = 0;
+	auto layout = topology.plan(ThreadTopology::PP_NONE, 0);
 #endif
-	mThread.reserve(maxworkers);
-	for (auto i = 0; i < maxworkers; ++i)
+	topology.apply(layout);
+	LOG(topology.getDescription());
+
+	auto& workers = layout.findGroup("worker")->threads;
+	Dispatcher::enableWorkStealing(workers.size());
+	mThread.reserve(workers.size());
+	for (size_t i = 0; i < workers.size(); ++i)
 	{
-		mThread.emplace_back("worker", i + 1,[](){
-			Dispatcher::run(Dispatcher::getSharedContext());
-		});
+		mThread.emplace_back("worker", i + 1,[i](){
+			Dispatcher::runWorker(i);
+		}, workers[i]);
 	}
 
 
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// move-only replacement of std::function.
+// callables up to InlineSize bytes are stored in place, bigger ones fall back to the heap.
+template<class Signature, size_t InlineSize = 56>
+class UniqueFunction;
+
+template<class R, class ... Args, size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize>
+{
+public:
+	UniqueFunction() = default;
+	UniqueFunction(std::nullptr_t) {}
+
+	template<class F, class = std::enable_if_t<
+		!std::is_same_v<std::decay_t<F>, UniqueFunction> &&
+		std::is_invocable_r_v<R, std::decay_t<F>&, Args...>>>
+	UniqueFunction(F&& f)
+	{
+		using Functor = std::decay_t<F>;
+		if constexpr (IsInline<Functor>)
+			new (mStorage) Functor(std::forward<F>(f));
+		else
+			*reinterpret_cast<Functor**>(mStorage) = new Functor(std::forward<F>(f));
+		mOps = &OpsFor<Functor>::ops;
+	}
+
+	UniqueFunction(UniqueFunction&& f) noexcept
+	{
+		moveFrom(f);
+	}
+
+	UniqueFunction(const UniqueFunction&) = delete;
+	UniqueFunction& operator=(const UniqueFunction&) = delete;
+
+	~UniqueFunction()
+	{
+		reset();
+	}
+
+	UniqueFunction& operator=(UniqueFunction&& f) noexcept
+	{
+		if (this != &f)
+		{
+			reset();
+			moveFrom(f);
+		}
+		return *this;
+	}
+
+	UniqueFunction& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	// const like std::function, the target itself may be mutable
+	R operator()(Args... args)const
+	{
+		return mOps->invoke(const_cast<unsigned char*>(mStorage), std::forward<Args>(args)...);
+	}
+
+	explicit operator bool()const
+	{
+		return mOps != nullptr;
+	}
+
+private:
+	struct Ops
+	{
+		R(*invoke)(void* storage, Args&& ... args);
+		void(*move)(void* dst, void* src);
+		void(*destroy)(void* storage);
+	};
+
+	template<class F>
+	static constexpr bool IsInline = sizeof(F) <= InlineSize &&
+		alignof(F) <= alignof(std::max_align_t) &&
+		std::is_nothrow_move_constructible_v<F>;
+
+	template<class F>
+	struct OpsFor
+	{
+		static F* get(void* storage)
+		{
+			if constexpr (IsInline<F>)
+				return reinterpret_cast<F*>(storage);
+			else
+				return *reinterpret_cast<F**>(storage);
+		}
+
+		static R invoke(void* storage, Args&& ... args)
+		{
+			return (*get(storage))(std::forward<Args>(args)...);
+		}
+
+		static void move(void* dst, void* src)
+		{
+			if constexpr (IsInline<F>)
+			{
+				new (dst) F(std::move(*get(src)));
+				get(src)->~F();
+			}
+			else
+				*reinterpret_cast<F**>(dst) = get(src);
+		}
+
+		static void destroy(void* storage)
+		{
+			if constexpr (IsInline<F>)
+				get(storage)->~F();
+			else
+				delete get(storage);
+		}
+
+		static constexpr Ops ops = { &invoke, &move, &destroy };
+	};
+
+	void moveFrom(UniqueFunction& f)
+	{
+		if (!f.mOps)
+			return;
+		f.mOps->move(mStorage, f.mStorage);
+		mOps = f.mOps;
+		f.mOps = nullptr;
+	}
+
+	void reset()
+	{
+		if (!mOps)
+			return;
+		mOps->destroy(mStorage);
+		mOps = nullptr;
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+	const Ops* mOps = nullptr;
+};
@@ -0,0 +1,256 @@
+#include "HazardValidator.h"
+#include <algorithm>
+#include <sstream>
+
+// messages are put together by hand, std::format is missing from some of the standard libraries it builds with
+template<class ... Args>
+static std::string concat(const Args& ... args)
+{
+	std::ostringstream ss;
+	(ss << ... << args);
+	return ss.str();
+}
+
+static std::string hex(UINT value)
+{
+	std::ostringstream ss;
+	ss << "0x" << std::hex << value;
+	return ss.str();
+}
+
+HazardValidator::View::View(const std::string& name, RenderTypes::ViewType type, UINT mips):
+	mName(name), mType(type), mMips(std::max(mips, 1u))
+{
+}
+
+void HazardValidator::View::setState(const D3D12_RESOURCE_STATES& s, UINT sub)
+{
+	for (UINT i = 0; i < mMips.size(); ++i)
+	{
+		if (sub != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && sub != i)
+			continue;
+		mMips[i].state = s;
+		mMips[i].known = true;
+	}
+}
+
+HazardValidator::CommandList::CommandList(HazardValidator& validator, int queue):
+	mValidator(validator), mQueue(queue)
+{
+}
+
+HazardValidator::CommandList::~CommandList()
+{
+	if (!mPending.empty())
+		mValidator.error(concat(mPending.size(), " barriers are recorded but not flushed"));
+}
+
+void HazardValidator::CommandList::transitionBarrier(View* view, D3D12_RESOURCE_STATES state, UINT subresource, bool autoflush)
+{
+	mPending.push_back({ OT_TRACKED, view, subresource, 1, state, state });
+	if (autoflush)
+		flushResourceBarrier();
+}
+
+void HazardValidator::CommandList::uavBarrier(View* view, bool autoflush)
+{
+	mPending.push_back({ OT_UAV, view, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, 1, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS });
+	if (autoflush)
+		flushResourceBarrier();
+}
+
+void HazardValidator::CommandList::transition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mPending.push_back({ OT_TRANSITION, view, subresource, 1, before, after });
+}
+
+void HazardValidator::CommandList::beginTransition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mPending.push_back({ OT_BEGIN, view, subresource, 1, before, after });
+}
+
+void HazardValidator::CommandList::endTransition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mPending.push_back({ OT_END, view, subresource, 1, before, after });
+}
+
+void HazardValidator::CommandList::flushResourceBarrier()
+{
+	mValidator.flush(mQueue, mPending);
+	mPending.clear();
+}
+
+void HazardValidator::CommandList::discardResource(View* view, UINT first, UINT count)
+{
+	auto state = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	switch (view->getViewType())
+	{
+	case RenderTypes::VT_RENDERTARGET: state = D3D12_RESOURCE_STATE_RENDER_TARGET; break;
+	case RenderTypes::VT_DEPTHSTENCIL: state = D3D12_RESOURCE_STATE_DEPTH_WRITE; break;
+	default: break;
+	}
+	for (UINT mip = first; mip < std::min(view->getMipLevels(), count == (UINT)-1 ? count : first + count); ++mip)
+		mValidator.initialize(mQueue, view, mip, state, "discard");
+}
+
+void HazardValidator::CommandList::clearRenderTarget(View* view, const std::array<float, 4>&, UINT index)
+{
+	mValidator.initialize(mQueue, view, index, D3D12_RESOURCE_STATE_RENDER_TARGET, "clear");
+}
+
+void HazardValidator::CommandList::clearDepthStencil(View* view, float, UINT8)
+{
+	mValidator.initialize(mQueue, view, 0, D3D12_RESOURCE_STATE_DEPTH_WRITE, "clear");
+}
+
+HazardValidator::View* HazardValidator::addView(const std::string& name, RenderTypes::ViewType type, UINT mips)
+{
+	mViews.emplace_back(new View(name, type, mips));
+	return mViews.back().get();
+}
+
+void HazardValidator::flush(int queue, std::vector<CommandList::Op>& barriers)
+{
+	// tracked transitions go first, explicit ones last
+	std::stable_partition(barriers.begin(), barriers.end(), [](auto& p) { return p.type == CommandList::OT_TRACKED; });
+	for (auto& p : barriers)
+	{
+		for (UINT mip = 0; mip < p.view->getMipLevels(); ++mip)
+		{
+			if (p.first != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES && mip != p.first)
+				continue;
+
+			auto& m = p.view->mMips[mip];
+			if (p.type == CommandList::OT_UAV)
+			{
+				barrier(queue, p.view, mip, false);
+				continue;
+			}
+			if (p.type == CommandList::OT_TRACKED)
+			{
+				// the state recorded in the resource is the before state, no barrier if it does not change
+				if (m.known && m.state == p.after)
+					continue;
+			}
+			else if (m.splitting != (p.type == CommandList::OT_END))
+				error(concat(p.view->getName(), " mip ", mip, m.splitting ? " is transitioned during a split transition" : " ends a split transition that is not begun"));
+			else if (m.known && m.state != (p.type == CommandList::OT_END ? p.after : p.before))
+				error(concat("transition of ", p.view->getName(), " mip ", mip, " from ", hex(p.before), ", but it is in ", hex(m.state)));
+
+			// a split transition takes the state at its begin, the end only makes it usable again
+			if (p.type == CommandList::OT_BEGIN)
+				m.splitting = true;
+			else if (p.type == CommandList::OT_END)
+				m.splitting = false;
+			m.state = p.after;
+			m.known = true;
+			barrier(queue, p.view, mip, true);
+		}
+	}
+}
+
+void HazardValidator::initialize(int queue, View* view, UINT mip, D3D12_RESOURCE_STATES state, const std::string& who)
+{
+	access(queue, view, mip, state, true, who);
+	// the passes after it see the initialized contents without a barrier
+	view->mMips[mip].write.barrier = true;
+	mPasses[queue] = {};
+}
+
+void HazardValidator::access(int queue, View* view, UINT mip, D3D12_RESOURCE_STATES state, bool write, const std::string& pass)
+{
+	auto& m = view->mMips[mip];
+	// the accesses of one pass happen at once
+	auto& current = mPasses[queue];
+	if (current.first != pass)
+		current = { pass, mPositions[queue]++ };
+	View::Event event = { queue, current.second, state, false, write, pass };
+
+	if (!m.known)
+		error(concat(pass, " uses ", view->getName(), " mip ", mip, " before any transition of the frame"));
+	else if (m.splitting)
+		error(concat(pass, " uses ", view->getName(), " mip ", mip, " during a split transition"));
+	else if (write ? m.state != state : (m.state & state) != state)
+		error(concat(pass, " uses ", view->getName(), " mip ", mip, " as ", hex(state), ", but it is in ", hex(m.state)));
+
+	check(view, mip, m.write, event);
+	if (!write)
+	{
+		m.reads[queue] = event;
+		return;
+	}
+	for (auto& [q, read] : m.reads)
+		check(view, mip, read, event);
+	m.write = event;
+	m.reads.clear();
+}
+
+void HazardValidator::signal(int queue, size_t point)
+{
+	mSignals[{ queue, point }] = mPositions[queue];
+}
+
+void HazardValidator::wait(int queue, int other, size_t point)
+{
+	auto s = mSignals.find({ other, point });
+	if (s == mSignals.end())
+	{
+		error(concat("queue ", queue, " waits for point ", point, " of queue ", other, ", which is not signalled before"));
+		return;
+	}
+	auto& seen = mSeen[queue][other];
+	seen = std::max(seen, s->second);
+}
+
+void HazardValidator::barrier(int queue, View* view, UINT mip, bool transition)
+{
+	auto& m = view->mMips[mip];
+	auto position = mPositions[queue]++;
+	m.barriers[queue] = position;
+	mPasses[queue] = {};
+	if (!transition)
+		return;
+
+	// a transition rewrites the subresource, the other queue has to be done with it
+	View::Event event = { queue, position, m.state, true, true, "transition" };
+	check(view, mip, m.write, event);
+	for (auto& [q, read] : m.reads)
+		check(view, mip, read, event);
+	m.write = event;
+	m.reads.clear();
+}
+
+void HazardValidator::check(View* view, UINT mip, const View::Event& from, const View::Event& to)
+{
+	if (from.queue < 0)
+		return;
+	auto hazard = from.write ? (to.write ? "write-after-write" : "read-after-write") : "write-after-read";
+	if (from.queue != to.queue)
+	{
+		auto& seen = mSeen[to.queue];
+		auto s = seen.find(from.queue);
+		if (s == seen.end() || s->second <= from.position)
+			error(concat(hazard, " hazard on ", view->getName(), " mip ", mip, ": ", to.who, " on queue ", to.queue, " does not wait for ", from.who, " on queue ", from.queue));
+		return;
+	}
+
+	// one pass, or a transition that waits for everything before it
+	if (from.position == to.position || from.barrier || to.barrier)
+		return;
+	auto& m = view->mMips[mip];
+	auto b = m.barriers.find(to.queue);
+	if (b != m.barriers.end() && b->second > from.position)
+		return;
+	// the output merger keeps draws to one target in order
+	if (from.state == to.state && (to.state == D3D12_RESOURCE_STATE_RENDER_TARGET || to.state == D3D12_RESOURCE_STATE_DEPTH_WRITE))
+		return;
+	if (from.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS && to.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+		error(concat(hazard, " hazard on ", view->getName(), " mip ", mip, ": ", to.who, " needs a uav barrier after ", from.who));
+	else
+		error(concat(hazard, " hazard on ", view->getName(), " mip ", mip, ": no barrier between ", from.who, " and ", to.who));
+}
+
+void HazardValidator::error(std::string&& message)
+{
+	mErrors.emplace_back(std::move(message));
+}
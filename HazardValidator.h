@@ -0,0 +1,127 @@
+#pragma once
+
+#include "RenderTypes.h"
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// replays a frame without a device and reports accesses that are not ordered after the ones they depend on,
+// or that find their subresource in another state than they declared.
+// views only track states, the command list only records, and nothing here includes the renderer,
+// so it runs wherever the code compiles, without d3d12 as well.
+class HazardValidator
+{
+public:
+	class View
+	{
+		friend class HazardValidator;
+	public:
+		View(const std::string& name, RenderTypes::ViewType type, UINT mips);
+
+		RenderTypes::ViewType getViewType()const{return mType;}
+		const std::string& getName()const{return mName;}
+		UINT getMipLevels()const{return (UINT)mMips.size();}
+		const D3D12_RESOURCE_STATES& getState(UINT sub = 0)const{return mMips[sub].state;}
+		void setState(const D3D12_RESOURCE_STATES& s, UINT sub = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+	private:
+		struct Event
+		{
+			int queue = -1;
+			size_t position = 0;
+			D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
+			// transitions order themselves after the work before them on their queue
+			bool barrier = false;
+			bool write = false;
+			std::string who;
+		};
+
+		struct Mip
+		{
+			D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
+			// no state is known before the first transition of the frame
+			bool known = false;
+			// between the begin and the end of a split transition
+			bool splitting = false;
+			Event write;
+			// latest read of each queue since the write
+			std::map<int, Event> reads;
+			// latest barrier of each queue
+			std::map<int, size_t> barriers;
+		};
+
+		std::string mName;
+		RenderTypes::ViewType mType;
+		std::vector<Mip> mMips;
+	};
+
+	// stand-in for Renderer::CommandList with the calls the render graph records,
+	// the validator checks them as they would run on the queue
+	class CommandList
+	{
+		friend class HazardValidator;
+	public:
+		CommandList(HazardValidator& validator, int queue);
+		~CommandList();
+
+		void transitionBarrier(View* view, D3D12_RESOURCE_STATES state, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, bool autoflush = false);
+		void uavBarrier(View* view, bool autoflush = false);
+		void transition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		void beginTransition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		void endTransition(View* view, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		void flushResourceBarrier();
+		void discardResource(View* view, UINT first = 0, UINT count = -1);
+		void clearRenderTarget(View* view, const std::array<float, 4>& color, UINT index = 0);
+		void clearDepthStencil(View* view, float depth, UINT8 stencil);
+	private:
+		enum OpType
+		{
+			OT_TRACKED,
+			OT_TRANSITION,
+			OT_BEGIN,
+			OT_END,
+			OT_UAV,
+		};
+
+		struct Op
+		{
+			OpType type;
+			View* view;
+			UINT first;
+			UINT count;
+			D3D12_RESOURCE_STATES before;
+			D3D12_RESOURCE_STATES after;
+		};
+		HazardValidator& mValidator;
+		int mQueue;
+		// barriers wait in the list until they are flushed, like in Renderer::CommandList
+		std::vector<Op> mPending;
+	};
+
+	View* addView(const std::string& name, RenderTypes::ViewType type, UINT mips = 1);
+
+	void access(int queue, View* view, UINT mip, D3D12_RESOURCE_STATES state, bool write, const std::string& pass);
+	// the work of the queue so far is done when the point is reached
+	void signal(int queue, size_t point);
+	void wait(int queue, int other, size_t point);
+
+	const std::vector<std::string>& getErrors()const{return mErrors;}
+private:
+	void flush(int queue, std::vector<CommandList::Op>& barriers);
+	// clears and discards
+	void initialize(int queue, View* view, UINT mip, D3D12_RESOURCE_STATES state, const std::string& who);
+	void barrier(int queue, View* view, UINT mip, bool transition);
+	void check(View* view, UINT mip, const View::Event& from, const View::Event& to);
+	void error(std::string&& message);
+
+	std::vector<std::unique_ptr<View>> mViews;
+	// every pass and barrier takes a position on its queue
+	std::map<int, size_t> mPositions;
+	// pass of the latest access on each queue and its position
+	std::map<int, std::pair<std::string, size_t>> mPasses;
+	// mSeen[q][o] is the position of queue o the work of queue q waits for
+	std::map<int, std::map<int, size_t>> mSeen;
+	std::map<std::pair<int, size_t>, size_t> mSignals;
+	std::vector<std::string> mErrors;
+};
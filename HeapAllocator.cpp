@@ -0,0 +1,206 @@
+#include "HeapAllocator.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+// alignment is a power of two
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+HeapAllocator::HeapAllocator(uint64_t size, uint64_t granularity):
+	mSize(size & ~(granularity - 1)), mGranularity(granularity)
+{
+	assert(std::has_single_bit(granularity) && "granularity must be a power of two");
+	for (auto& fl : mFreeLists)
+		fl.fill(NONE);
+
+	auto range = newRange();
+	mRanges[range].size = mSize;
+	insertFree(range);
+}
+
+uint64_t HeapAllocator::alloc(uint64_t size, uint64_t alignment)
+{
+	size = alignUp(std::max(size, (uint64_t)1), mGranularity);
+	alignment = std::max(alignment, mGranularity);
+	assert(std::has_single_bit(alignment) && "alignment must be a power of two");
+	if (size > mSize)
+		return INVALID_OFFSET;
+
+	auto fits = [&](uint32_t range) {
+		auto& r = mRanges[range];
+		return alignUp(r.offset, alignment) - r.offset + size <= r.size;
+	};
+	// the first range of the class usually is aligned already, the padding is only reserved if it is not
+	auto range = findFree(size / mGranularity);
+	if (range == NONE || !fits(range))
+		range = findFree((size + alignment - mGranularity) / mGranularity);
+	if (range == NONE)
+		return INVALID_OFFSET;
+
+	removeFree(range);
+	auto offset = alignUp(mRanges[range].offset, alignment);
+	if (offset != mRanges[range].offset)
+	{
+		auto front = range;
+		range = split(front, offset - mRanges[front].offset);
+		insertFree(front);
+	}
+	if (mRanges[range].size > size)
+		insertFree(split(range, size));
+
+	mAllocated[offset] = range;
+	mUsed += size;
+	return offset;
+}
+
+void HeapAllocator::free(uint64_t offset)
+{
+	auto a = mAllocated.find(offset);
+	assert(a != mAllocated.end() && "range is not allocated");
+	auto range = a->second;
+	mAllocated.erase(a);
+	mUsed -= mRanges[range].size;
+
+	auto next = mRanges[range].next;
+	if (next != NONE && mRanges[next].free)
+	{
+		removeFree(next);
+		merge(range, next);
+	}
+	auto prev = mRanges[range].prev;
+	if (prev != NONE && mRanges[prev].free)
+	{
+		removeFree(prev);
+		merge(prev, range);
+		range = prev;
+	}
+	insertFree(range);
+}
+
+HeapAllocator::Stats HeapAllocator::getStats()const
+{
+	Stats stats;
+	stats.size = mSize;
+	stats.usedBytes = mUsed;
+	stats.allocations = mAllocated.size();
+	for (auto& r : mRanges)
+	{
+		if (r.free)
+			stats.freeRanges++;
+	}
+	if (mFirstLevel != 0)
+	{
+		// the sizes in the highest class are not sorted
+		auto fl = std::bit_width(mFirstLevel) - 1;
+		auto sl = std::bit_width(mSecondLevel[fl]) - 1;
+		for (auto r = mFreeLists[fl][sl]; r != NONE; r = mRanges[r].nextFree)
+			stats.largestFree = std::max(stats.largestFree, mRanges[r].size);
+	}
+	return stats;
+}
+
+std::pair<uint32_t, uint32_t> HeapAllocator::mapping(uint64_t count)
+{
+	uint32_t fl = std::bit_width(count) - 1;
+	// small classes hold a single size each
+	if (fl < SL_BITS)
+		return { fl, (uint32_t)(count << (SL_BITS - fl)) - SL_COUNT };
+	return { fl, (uint32_t)(count >> (fl - SL_BITS)) - SL_COUNT };
+}
+
+uint32_t HeapAllocator::findFree(uint64_t count)
+{
+	// round up to the next class, so every range of the class found is large enough
+	auto fl = std::bit_width(count) - 1;
+	if (fl >= SL_BITS)
+		count += (1ull << (fl - SL_BITS)) - 1;
+	auto [f, s] = mapping(count);
+
+	uint32_t slmap = mSecondLevel[f] & (~0u << s);
+	if (slmap == 0)
+	{
+		auto flmap = f + 1 < FL_COUNT ? mFirstLevel & (~0ull << (f + 1)) : 0;
+		if (flmap == 0)
+			return NONE;
+		f = std::countr_zero(flmap);
+		slmap = mSecondLevel[f];
+	}
+	return mFreeLists[f][std::countr_zero(slmap)];
+}
+
+void HeapAllocator::insertFree(uint32_t range)
+{
+	auto& r = mRanges[range];
+	auto [fl, sl] = mapping(r.size / mGranularity);
+	auto& head = mFreeLists[fl][sl];
+	r.free = true;
+	r.prevFree = NONE;
+	r.nextFree = head;
+	if (head != NONE)
+		mRanges[head].prevFree = range;
+	head = range;
+	mFirstLevel |= 1ull << fl;
+	mSecondLevel[fl] |= 1u << sl;
+}
+
+void HeapAllocator::removeFree(uint32_t range)
+{
+	auto& r = mRanges[range];
+	auto [fl, sl] = mapping(r.size / mGranularity);
+	if (r.prevFree != NONE)
+		mRanges[r.prevFree].nextFree = r.nextFree;
+	else
+		mFreeLists[fl][sl] = r.nextFree;
+	if (r.nextFree != NONE)
+		mRanges[r.nextFree].prevFree = r.prevFree;
+	r.free = false;
+
+	if (mFreeLists[fl][sl] != NONE)
+		return;
+	mSecondLevel[fl] &= ~(1u << sl);
+	if (mSecondLevel[fl] == 0)
+		mFirstLevel &= ~(1ull << fl);
+}
+
+uint32_t HeapAllocator::newRange()
+{
+	if (mUnusedRanges.empty())
+	{
+		mRanges.emplace_back();
+		return (uint32_t)mRanges.size() - 1;
+	}
+	auto range = mUnusedRanges.back();
+	mUnusedRanges.pop_back();
+	mRanges[range] = {};
+	return range;
+}
+
+uint32_t HeapAllocator::split(uint32_t range, uint64_t size)
+{
+	auto back = newRange();
+	auto& r = mRanges[range];
+	auto& b = mRanges[back];
+	b.offset = r.offset + size;
+	b.size = r.size - size;
+	b.prev = range;
+	b.next = r.next;
+	if (r.next != NONE)
+		mRanges[r.next].prev = back;
+	r.next = back;
+	r.size = size;
+	return back;
+}
+
+void HeapAllocator::merge(uint32_t range, uint32_t next)
+{
+	auto& r = mRanges[range];
+	auto& n = mRanges[next];
+	r.size += n.size;
+	r.next = n.next;
+	if (n.next != NONE)
+		mRanges[n.next].prev = range;
+	mUnusedRanges.push_back(next);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// two level segregated fit allocator of ranges in one block of memory, e.g. an ID3D12Heap.
+// free ranges are kept in size classes, the first level is the power of two of the size,
+// the second one splits it into SL_COUNT linear steps. a bitmap per level finds a fitting class in constant time,
+// freed ranges merge with their free neighbours right away.
+// it only hands out offsets, nothing here touches the device.
+class HeapAllocator
+{
+public:
+	static constexpr uint64_t INVALID_OFFSET = ~0ull;
+	static constexpr uint32_t SL_BITS = 4;
+	static constexpr uint32_t SL_COUNT = 1 << SL_BITS;
+	static constexpr uint32_t FL_COUNT = 64;
+
+	struct Stats
+	{
+		uint64_t size = 0;
+		uint64_t usedBytes = 0;
+		uint64_t largestFree = 0;
+		size_t allocations = 0;
+		size_t freeRanges = 0;
+	};
+
+	// offsets and sizes are multiples of granularity, which is a power of two
+	HeapAllocator(uint64_t size, uint64_t granularity = 256);
+
+	// offset of the range, INVALID_OFFSET if no free range fits
+	uint64_t alloc(uint64_t size, uint64_t alignment = 0);
+	void free(uint64_t offset);
+
+	bool empty()const { return mUsed == 0; }
+	uint64_t getSize()const { return mSize; }
+	uint64_t getUsed()const { return mUsed; }
+	Stats getStats()const;
+private:
+	static constexpr uint32_t NONE = ~0u;
+
+	struct Range
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		// neighbours in memory
+		uint32_t prev = NONE;
+		uint32_t next = NONE;
+		// neighbours in the free list of the size class
+		uint32_t prevFree = NONE;
+		uint32_t nextFree = NONE;
+		bool free = false;
+	};
+
+	// size class of a size in granules
+	static std::pair<uint32_t, uint32_t> mapping(uint64_t count);
+	uint32_t findFree(uint64_t count);
+	void insertFree(uint32_t range);
+	void removeFree(uint32_t range);
+	uint32_t newRange();
+	// the part of the range behind size becomes a range of its own
+	uint32_t split(uint32_t range, uint64_t size);
+	// next is merged into range
+	void merge(uint32_t range, uint32_t next);
+
+	uint64_t mSize;
+	uint64_t mGranularity;
+	uint64_t mUsed = 0;
+	std::vector<Range> mRanges;
+	std::vector<uint32_t> mUnusedRanges;
+	uint64_t mFirstLevel = 0;
+	std::array<uint32_t, FL_COUNT> mSecondLevel = {};
+	std::array<std::array<uint32_t, SL_COUNT>, FL_COUNT> mFreeLists;
+	// allocated ranges by offset
+	std::unordered_map<uint64_t, uint32_t> mAllocated;
+};
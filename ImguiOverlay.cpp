@@ -166,10 +166,9 @@ RenderGraph::RenderTask ImGuiPass::execute()
 		co_await std::suspend_always();
 		
 
-		while(!pass->mReady.load())
-			co_await std::suspend_always();
+		co_await pass->mReady;
 
-		pass->mReady.store(false);
+		pass->mReady.reset();
 		endFrame();
 
 		co_await std::suspend_always();
@@ -22,7 +22,7 @@ public:
 
 	RenderGraph::RenderTask execute() ;
 	static void resize( int width, int height);
-	void ready(){mReady.store(true);}
+	void ready(){mReady.set();}
 private:
 	void initImGui();
 	void initRendering();
@@ -41,6 +41,6 @@ private:
 	int mHeight = 0;
 
 	FenceObject mFence;
-	std::atomic<bool> mReady = false;
+	AwaitableFlag mReady;
 };
 
@@ -0,0 +1,131 @@
+#pragma once
+
+// headless stand-in for the parts of the renderer the render graph is declared with.
+// enough to build the graph, compile its plan and validate it without a device, recording needs the real one.
+#include "RenderTypes.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define LOG(msg) (fprintf(stderr, "%s\n", std::string(msg).c_str()))
+#define ASSERT(x, msg) assert((x) && msg)
+#define PROFILE(name, cl)
+#define CHECK_RENDER_THREAD
+
+// same values as in dxgiformat.h, only the formats the tests use
+enum DXGI_FORMAT
+{
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R32G32B32A32_FLOAT = 2,
+	DXGI_FORMAT_R16G16B16A16_FLOAT = 10,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_R32_FLOAT = 41,
+	DXGI_FORMAT_D24_UNORM_S8_UINT = 45,
+};
+
+using Color = std::array<float, 4>;
+
+class Common
+{
+public:
+	// names of the tests are plain ascii
+	static std::string convert(const std::wstring& str)
+	{
+		return std::string(str.begin(), str.end());
+	}
+};
+
+class D3DHelper
+{
+public:
+	static size_t sizeof_DXGI_FORMAT(DXGI_FORMAT format)
+	{
+		switch (format)
+		{
+		case DXGI_FORMAT_R32G32B32A32_FLOAT: return 16;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT: return 8;
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R32_FLOAT:
+		case DXGI_FORMAT_D24_UNORM_S8_UINT: return 4;
+		default: return 0;
+		}
+	}
+};
+
+class Renderer : public RenderTypes
+{
+public:
+	union ClearValue
+	{
+		Color color;
+		struct {
+			float depth;
+			UINT8 stencil;
+		};
+	};
+
+	// views are never created, the graph only passes them around
+	class Resource
+	{
+	public:
+		using Ref = std::shared_ptr<Resource>;
+	};
+
+	class CommandList
+	{
+	};
+
+	class Profile
+	{
+	public:
+		using Ref = std::shared_ptr<Profile>;
+
+		float getCPUTime()const { return 0; }
+		void begin(CommandList*) {}
+		void end(CommandList*) {}
+	};
+};
+
+// no timings without a device, compile() balances the command lists as if every pass cost the same
+class ProfileMgr
+{
+public:
+	static ProfileMgr Singleton;
+
+	Renderer::Profile::Ref getProfile(const std::string&) { return std::make_shared<Renderer::Profile>(); }
+	Renderer::Profile::Ref findProfile(const std::string&) { return {}; }
+};
+inline ProfileMgr ProfileMgr::Singleton;
+
+// hands out a fresh view for every allocation, the key is the one the real pool uses to share views
+class ResourceViewAllocator
+{
+public:
+	static ResourceViewAllocator Singleton;
+
+	std::pair<Renderer::Resource::Ref, size_t> alloc(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, const Renderer::ClearValue& cv, UINT mips = 1)
+	{
+		return { std::make_shared<Renderer::Resource>(), hash(width, height, depth, format, type, cv, mips) };
+	}
+
+	size_t hash(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, const Renderer::ClearValue&, UINT mips = 1)
+	{
+		size_t value = 0;
+		for (size_t v : { (size_t)width, (size_t)height, (size_t)depth, (size_t)format, (size_t)type, (size_t)mips })
+			value ^= std::hash<size_t>()(v) + 0x9e3779b9 + (value << 6) + (value >> 2);
+		return value;
+	}
+
+	void recycle(const Renderer::Resource::Ref&, size_t = 0) {}
+	void trim() {}
+};
+inline ResourceViewAllocator ResourceViewAllocator::Singleton;
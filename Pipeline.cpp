@@ -88,7 +88,8 @@ void Pipeline::execute()
 	//Dispatcher::getSharedContext().dispatch([=](){
 	//	mGui->update(mGUICallback);
 	//});
-	mGraph.execute(Renderer::getSingleton()->getRenderQueue());
+	auto renderer = Renderer::getSingleton();
+	mGraph.execute(renderer->getRenderQueue(), renderer->getComputeQueue());
 
 }
 
@@ -206,7 +207,8 @@ void ForwardPipleline::execute()
 	//Dispatcher::getSharedContext().dispatch([=](){
 	//	mGui->update(mGUICallback);
 	//});
-	mGraph.execute(Renderer::getSingleton()->getRenderQueue());
+	auto renderer = Renderer::getSingleton();
+	mGraph.execute(renderer->getRenderQueue(), renderer->getComputeQueue());
 
 
 }
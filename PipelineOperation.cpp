@@ -36,7 +36,7 @@ RenderGraph::RenderPass PipelineOperation::renderUI( ResourceHandle::Ptr rendert
 			cmdlist->setRenderTarget(dst->getView());
 			while (!co.done())
 			{
-				co_await std::suspend_always();
+				co_await co.yield();
 				co.resume();
 			}
 			co_return;
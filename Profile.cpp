@@ -54,6 +54,28 @@ void ProfileMgr::end(Renderer::Profile::Ref p, Renderer::CommandList * cl)
 	nodeStack.pop_back();
 }
 
+Renderer::Profile::Ref ProfileMgr::getProfile(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	// kept apart from the paths begin() uses as keys
+	Node*& node = mProfiles["#" + name];
+	if (node == NULL)
+	{
+		node = new Node();
+		node->name = name;
+		node->profile = Renderer::getSingleton()->createProfile();
+	}
+	return node->profile;
+}
+
+Renderer::Profile::Ref ProfileMgr::findProfile(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto node = mProfiles.find("#" + name);
+	if (node == mProfiles.end())
+		return {};
+	return node->second->profile;
+}
 
 void ProfileMgr::reset()
 {
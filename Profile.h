@@ -59,6 +59,11 @@ public:
 
 	Renderer::Profile::Ref begin(const std::string& name, Renderer::CommandList * cl);
 	void end(Renderer::Profile::Ref p, Renderer::CommandList * cl);
+	// a top level profile begun and ended by hand, it does not nest like begin() does,
+	// so coroutines resuming on other threads can use it
+	Renderer::Profile::Ref getProfile(const std::string& name);
+	// the profile getProfile() made for name, empty if there is none yet
+	Renderer::Profile::Ref findProfile(const std::string& name);
 	void reset();
 
 	void visit(const std::function<void(Node*, size_t)>& visitor);
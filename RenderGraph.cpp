@@ -1,6 +1,11 @@
 #include "RenderGraph.h"
+#if !defined(_HEADLESS)
 #include "Profile.h"
 #include "ResourceViewAllocator.h"
+#include "D3DHelper.h"
+#endif
+#include "HazardValidator.h"
+#include <exception>
 
 
 ResourceHandle::Ptr ResourceHandle::create(Renderer::ViewType type, int w, int h, DXGI_FORMAT format, Renderer::ClearValue cv)
@@ -15,7 +20,9 @@ ResourceHandle::Ptr ResourceHandle::create(Renderer::ViewType type, int w, int h
 
 ResourceHandle::Ptr ResourceHandle::clone(ResourceHandle::Ptr res)
 {
-	return create(res->getType(),res->mWidth, res->mHeight,res->mDepth, res->mFormat, res->mClearValue);
+	auto ret = create(res->getType(),res->mWidth, res->mHeight,res->mDepth, res->mFormat, res->mClearValue);
+	ret->mMips = res->mMips;
+	return ret;
 }
 
 ResourceHandle::ResourceHandle(Renderer::ViewType t, int w, int h, int d, DXGI_FORMAT format, Renderer::ClearValue cv):
@@ -25,10 +32,7 @@ ResourceHandle::ResourceHandle(Renderer::ViewType t, int w, int h, int d, DXGI_F
 
 ResourceHandle::~ResourceHandle()
 {
-	std::lock_guard<std::mutex> lock(mViewMutex);
-	if (mView)
-		ResourceViewAllocator::Singleton.recycle(mView, mHashValue);
-	mView = {};
+	releaseView();
 }
 
 Renderer::ViewType ResourceHandle::getType() const
@@ -57,13 +61,73 @@ const Renderer::Resource::Ref& ResourceHandle::getView()
 	std::lock_guard<std::mutex> lock(mViewMutex);
 	if (!mView)
 	{
-		auto ret = ResourceViewAllocator::Singleton.alloc(mWidth, mHeight, mDepth, mFormat,mType, mClearValue);
+		auto ret = allocate();
 		mView = ret.first;
 		mHashValue = ret.second;
 	}
 	return mView; 
 }
 
+void ResourceHandle::setMipLevels(UINT mips)
+{
+	ASSERT(!mView, "mips of an allocated view cannot change");
+	UINT full = 1;
+	for (auto size = std::max({ mWidth, mHeight, mDepth }); size > 1; size >>= 1)
+		full++;
+	mMips = std::clamp(mips, 1u, full);
+}
+
+size_t ResourceHandle::getSize() const
+{
+	size_t size = 0;
+	for (UINT mip = 0; mip < mMips; ++mip)
+		size += (size_t)std::max(mWidth >> mip, 1) * std::max(mHeight >> mip, 1) * std::max(mDepth >> mip, 1);
+	return size * D3DHelper::sizeof_DXGI_FORMAT(mFormat);
+}
+
+std::pair<Renderer::Resource::Ref, size_t> ResourceHandle::allocate() const
+{
+	return ResourceViewAllocator::Singleton.alloc(mWidth, mHeight, mDepth, mFormat, mType, mClearValue, mMips);
+}
+
+size_t ResourceHandle::getPoolKey() const
+{
+	return ResourceViewAllocator::Singleton.hash(mWidth, mHeight, mDepth, mFormat, mType, mClearValue, mMips);
+}
+
+void ResourceHandle::bindView(const Renderer::Resource::Ref& view)
+{
+	std::lock_guard<std::mutex> lock(mViewMutex);
+	if (mView && !mBound)
+		ResourceViewAllocator::Singleton.recycle(mView, mHashValue);
+	mView = view;
+	mBound = true;
+}
+
+void ResourceHandle::unbindView()
+{
+	std::lock_guard<std::mutex> lock(mViewMutex);
+	if (!mBound)
+		return;
+	mView = {};
+	mBound = false;
+}
+
+void ResourceHandle::releaseView()
+{
+	std::lock_guard<std::mutex> lock(mViewMutex);
+	if (mBound)
+		return;
+	if (mView)
+		ResourceViewAllocator::Singleton.recycle(mView, mHashValue);
+	mView = {};
+}
+
+RenderGraph::~RenderGraph()
+{
+	releaseTransients();
+}
+
 
 void RenderGraph::addPass(const std::string& name, RenderPass&& callback)
 {
@@ -71,151 +135,1165 @@ void RenderGraph::addPass(const std::string& name, RenderPass&& callback)
 }
 
 
-RenderGraph::Barrier::Ptr RenderGraph::addBarrier(const std::string& name)
+RenderGraph::Barrier::Ptr RenderGraph::addBarrier(const std::string& name, UniqueFunction<void(Builder&)>&& setup)
 {
 	auto barrier = Barrier::Ptr(new Barrier);
-	mPasses.push_back({name, [barrier](auto&b )->RenderTask{
-		barrier->execute();
-		return {};
+	mBarrierPasses.push_back(mPasses.size());
+	mPasses.push_back({name, [this, barrier, setup = std::move(setup)](Builder& b)->RenderTask{
+		if (setup)
+			setup(b);
+		return [barrier, declared = b.mTransitions, validation = mValidation, missing = mMissingProfiles](Renderer::CommandList* cmdlist) {
+			return recordBarrier(barrier, declared, validation, missing, cmdlist);
+		};
 	}});
 	return barrier;
 }
 
-void RenderGraph::execute(Renderer::CommandQueue::Ref queue)
+Future<Promise> RenderGraph::recordBarrier(Barrier::Ptr barrier, std::vector<Builder::Transition> declared, bool validation, std::shared_ptr<MissingProfiles> missing, Renderer::CommandList* cmdlist)
 {
-	CHECK_RENDER_THREAD;
+	co_await std::suspend_always();
 
-	for (auto& pass : mPasses)
+	while (true)
 	{
-		PROFILE("add pass " + pass.first, {});
-		Builder b;
-		auto task = pass.second(b);
+		barrier->mArrived.reset();
+		// every pass added before the signal is visible once the signal is
+		auto signalled = barrier->mSignalled.isSet();
+		Barrier::Passes passes;
+		{
+			std::lock_guard<std::mutex> lock(barrier->mMutex);
+			passes.swap(barrier->mPasses);
+		}
 
-		if (!b.empty())
+		for (auto& [name, pass] : passes)
 		{
-			queue->addCommand([b = std::move(b)](auto cmdlist){
-				b.prepare(cmdlist);
-			},  true);
+			Builder builder;
+			auto task = pass(builder);
+			// reported like the hazards of validate(), the barrier planned none of these
+			if (validation)
+			{
+				for (auto& t : builder.mTransitions)
+				{
+					auto d = std::find_if(declared.begin(), declared.end(), [&](auto& d) {
+						return d.res == t.res && d.state == t.state && (d.write || !t.write);
+					});
+					if (d != declared.end())
+						continue;
+					auto handle = t.res->getName().empty() ? std::string("a handle") : Common::convert(t.res->getName());
+					LOG("render graph: " + name + (t.write ? " writes " : " reads ") + handle + " in a state its barrier does not declare");
+				}
+			}
+			if (!task)
+				continue;
+
+			auto profile = ProfileMgr::Singleton.findProfile(name);
+			if (!profile)
+			{
+				std::lock_guard<std::mutex> lock(missing->mutex);
+				missing->names.push_back(name);
+			}
+			Coroutine<Promise> co(task, cmdlist);
+			if (profile)
+				profile->begin(cmdlist);
+			while (!co.done())
+			{
+				co_await co.yield();
+				co.resume();
+			}
+			if (profile)
+				profile->end(cmdlist);
 		}
-		//if (task)
+
+		if (passes.empty())
 		{
-			queue->addCoroutineCommand(std::move(task), false);
-			//queue->addCommand([n = std::move(pass.first), t = std::move(task)](auto cmdlist) {
-			//	PROFILE(n, cmdlist);
-			//	t(cmdlist);
-			//},  false);
+			if (signalled)
+				break;
+			// parks the group until a producer adds a pass or signals, the worker moves on
+			co_await barrier->mArrived;
 		}
 	}
+	co_return;
 }
 
-void RenderGraph::reset()
+RenderGraph::History::Ptr RenderGraph::createHistory(const ResourceHandle::Ptr& desc)
 {
-	mPasses.clear();
+	auto history = History::Ptr(new History);
+	for (auto& handle : history->mHandles)
+	{
+		handle = ResourceHandle::clone(desc);
+		handle->setName(desc->getName());
+		// written for the next frame, nothing in this one may cull it
+		handle->setImported(true);
+	}
+	mHistories.push_back(history);
+	return history;
 }
 
+void RenderGraph::advanceHistories()
+{
+	std::set<ResourceHandle*> used;
+	std::set<ResourceHandle*> written;
+	for (auto index : mCompiled.order)
+	{
+		for (auto& t : mPrepared[index].builder.mTransitions)
+		{
+			used.insert(t.res.get());
+			if (t.write)
+				written.insert(t.res.get());
+		}
+	}
+
+	for (auto i = mHistories.begin(); i != mHistories.end(); )
+	{
+		auto history = i->lock();
+		if (!history)
+		{
+			i = mHistories.erase(i);
+			continue;
+		}
+		++i;
+
+		auto& current = history->getCurrent();
+		auto& previous = history->getPrevious();
+		auto unused = !used.count(current.get()) && !used.count(previous.get());
+		history->mUnused = unused ? history->mUnused + 1 : 0;
+		history->mValid = written.count(current.get()) != 0;
+		history->mCurrent ^= 1;
+		if (history->mUnused < mHistoryLifetime)
+			continue;
 
-void RenderGraph::Builder::read(const ResourceHandle::Ptr& res)
+		// views keep their recorded states, whoever gets them from the pool next starts from there
+		for (auto& handle : history->mHandles)
+			handle->releaseView();
+		history->mValid = false;
+	}
+}
+
+const RenderGraph::CompiledGraph& RenderGraph::compile(bool asyncCompute)
 {
-	mTransitions.push_back({res, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, IT_NONE});
+	if (mIsCompiled && mCompiled.asyncCompute == asyncCompute)
+		return mCompiled;
+
+	// setups run once per frame, only the plan is redone for the other queue layout
+	if (!mIsCompiled)
+	{
+		mPrepared.clear();
+		mPrepared.resize(mPasses.size());
+		auto setup = [this](size_t index) {
+			PROFILE("add pass " + mPasses[index].first, {});
+			auto& prepared = mPrepared[index];
+			prepared.task = mPasses[index].second(prepared.builder);
+		};
+		// every setup fills the slot of its insertion index, one per task since their costs vary a lot
+		if (mParallelSetup)
+			mSetupExecutor.parallel_for(0, mPasses.size(), 1, setup);
+		else
+		{
+			for (size_t i = 0; i < mPasses.size(); ++i)
+				setup(i);
+		}
+	}
+
+	auto key = getStructureKey(asyncCompute);
+	auto hash = std::hash<std::string>{}(key);
+	mCacheHit = hash == mCompiled.structureHash && key == mCompiled.structureKey;
+	if (mCacheHit)
+	{
+		mCacheStats.hits++;
+		// the handles of this frame take the places of last frame's, in the order they were found
+		std::set<ResourceHandle*> found;
+		size_t next = 0;
+		for (auto index : mCompiled.order)
+		{
+			for (auto& t : mPrepared[index].builder.mTransitions)
+			{
+				if (found.insert(t.res.get()).second)
+					mCompiled.lifetimes[next++].handle = t.res;
+			}
+		}
+		// timings change from frame to frame
+		for (auto& groups : mCompiled.groups)
+			groups.clear();
+		partition();
+
+		mIsCompiled = true;
+		return mCompiled;
+	}
+	mCacheStats.misses++;
+
+	auto count = mPrepared.size();
+	const size_t none = -1;
+	struct Version
+	{
+		size_t writer = -1;
+		std::vector<size_t> readers;
+	};
+	// mips are versioned apart, a pass can read one mip of a handle and write another
+	std::map<std::pair<ResourceHandle*, UINT>, Version> versions;
+	// every edge orders two passes, only data edges keep the producer alive
+	std::vector<std::set<size_t>> edges(count);
+	std::vector<std::set<size_t>> dataEdges(count);
+	std::vector<bool> alive(count, false);
+
+	// passes only ever depend on earlier ones, so insertion order is already topological
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& transitions = mPrepared[i].builder.mTransitions;
+		bool writes = false;
+		for (auto& t : transitions)
+		{
+			for (auto mip = t.mips.first; mip < t.end(); ++mip)
+			{
+				auto& v = versions[{ t.res.get(), mip }];
+				if (t.read && v.writer != none)
+				{
+					edges[i].insert(v.writer);
+					dataEdges[i].insert(v.writer);
+				}
+				if (t.write)
+				{
+					if (v.writer != none)
+					{
+						edges[i].insert(v.writer);
+						// clearing or discarding drops the previous content
+						if (t.type != Builder::IT_CLEAR && t.type != Builder::IT_DISCARD)
+							dataEdges[i].insert(v.writer);
+					}
+					for (auto r : v.readers)
+						edges[i].insert(r);
+				}
+			}
+			if (t.write)
+			{
+				writes = true;
+				if (t.res->isImported())
+					alive[i] = true;
+			}
+		}
+		// nothing written means the pass works on things outside the graph
+		if (!writes)
+			alive[i] = true;
+
+		// the pass becomes the current version only after all of its accesses are resolved
+		for (auto& t : transitions)
+		{
+			if (!t.read || t.write)
+				continue;
+			for (auto mip = t.mips.first; mip < t.end(); ++mip)
+				versions[{ t.res.get(), mip }].readers.push_back(i);
+		}
+		for (auto& t : transitions)
+		{
+			if (!t.write)
+				continue;
+			for (auto mip = t.mips.first; mip < t.end(); ++mip)
+			{
+				auto& v = versions[{ t.res.get(), mip }];
+				v.writer = i;
+				v.readers.clear();
+			}
+		}
+	}
+
+	for (size_t i = count; i-- > 0;)
+	{
+		if (!alive[i])
+			continue;
+		for (auto p : dataEdges[i])
+			alive[p] = true;
+	}
+
+	mCompiled = {};
+	mCompiled.asyncCompute = asyncCompute;
+	mCompiled.nodes.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& node = mCompiled.nodes[i];
+		node.queue = asyncCompute ? mPrepared[i].builder.mAffinity : QA_GRAPHICS;
+		node.culled = !alive[i];
+		if (node.culled)
+		{
+			mCompiled.numCulled++;
+			continue;
+		}
+
+		for (auto p : edges[i])
+		{
+			if (!alive[p])
+				continue;
+			node.predecessors.push_back(p);
+			mCompiled.nodes[p].successors.push_back(i);
+			node.level = std::max(node.level, mCompiled.nodes[p].level + 1);
+		}
+
+		if (mCompiled.levels.size() <= node.level)
+			mCompiled.levels.resize(node.level + 1);
+		mCompiled.levels[node.level].push_back(i);
+	}
+
+	for (auto& level : mCompiled.levels)
+		mCompiled.order.insert(mCompiled.order.end(), level.begin(), level.end());
+
+	computeLifetimes();
+	planBarriers();
+	partition();
+	mCompiled.structureHash = hash;
+	mCompiled.structureKey = std::move(key);
+
+	mIsCompiled = true;
+	return mCompiled;
 }
 
-void RenderGraph::Builder::write(const ResourceHandle::Ptr& res, InitialType type)
+std::string RenderGraph::getStructureKey(bool asyncCompute) const
 {
-	if (res->getType() == Renderer::VT_DEPTHSTENCIL)
-		mTransitions.push_back({res, D3D12_RESOURCE_STATE_DEPTH_WRITE , type});
-	else
-		mTransitions.push_back({ res, D3D12_RESOURCE_STATE_RENDER_TARGET , type });
+	// the fields themselves, a plan is only reused if they all match and not just their hash
+	std::string key;
+	auto append = [&](const auto& ... values) {
+		(key.append((const char*)&values, sizeof(values)), ...);
+	};
+	append(asyncCompute, mPrepared.size());
+	// handles are numbered by first use, so a graph rebuilt with new handles has the same key
+	std::unordered_map<ResourceHandle*, size_t> ids;
+	for (size_t i = 0; i < mPrepared.size(); ++i)
+	{
+		auto& builder = mPrepared[i].builder;
+		auto& name = mPasses[i].first;
+		append(name.size());
+		key += name;
+		append(builder.mAffinity, (bool)mPrepared[i].task, builder.mTransitions.size());
+		for (auto& t : builder.mTransitions)
+		{
+			auto ret = ids.emplace(t.res.get(), ids.size());
+			append(ret.first->second, t.state, t.type, t.read, t.write, t.mips.first, t.end());
+			if (!ret.second)
+				continue;
+			auto& res = *t.res;
+			// the whole clear value, depth and stencil share it with the color
+			append(res.mType, res.mWidth, res.mHeight, res.mDepth, res.mMips, res.mFormat, res.mImported, res.mClearValue);
+		}
+	}
+	return key;
 }
 
-void RenderGraph::Builder::access(const ResourceHandle::Ptr& res, InitialType type)
+void RenderGraph::computeLifetimes()
 {
-	mTransitions.push_back({res, D3D12_RESOURCE_STATE_UNORDERED_ACCESS , type });
+	struct FirstUse
+	{
+		bool reads = false;
+		bool overwrites = false;
+	};
+	auto& lifetimes = mCompiled.lifetimes;
+	std::unordered_map<ResourceHandle*, size_t> indices;
+	std::vector<FirstUse> firstUses;
+	for (size_t level = 0; level < mCompiled.levels.size(); ++level)
+	{
+		for (auto pass : mCompiled.levels[level])
+		{
+			for (auto& t : mPrepared[pass].builder.mTransitions)
+			{
+				auto ret = indices.emplace(t.res.get(), lifetimes.size());
+				if (ret.second)
+				{
+					lifetimes.push_back({ t.res, level, level });
+					firstUses.push_back({});
+				}
+				auto index = ret.first->second;
+				lifetimes[index].last = level;
+				if (lifetimes[index].first != level)
+					continue;
+				auto& use = firstUses[index];
+				use.reads = use.reads || t.read;
+				use.overwrites = use.overwrites || t.type == Builder::IT_CLEAR || t.type == Builder::IT_DISCARD;
+			}
+		}
+	}
+
+	// greedy interval assignment, a slot is reused by the next handle of the same pool key that starts after it ends
+	struct Slot
+	{
+		size_t key;
+		size_t last;
+	};
+	std::vector<Slot> slots;
+	for (size_t i = 0; i < lifetimes.size(); ++i)
+	{
+		auto& lifetime = lifetimes[i];
+		auto& handle = lifetime.handle;
+		// anything else expects the content of the previous frame
+		if (handle->isImported() || firstUses[i].reads || !firstUses[i].overwrites)
+			continue;
+
+		auto size = handle->getSize();
+		auto key = handle->getPoolKey();
+		mCompiled.transientMemory += size;
+		for (size_t s = 0; s < slots.size(); ++s)
+		{
+			if (slots[s].key == key && slots[s].last < lifetime.first)
+			{
+				lifetime.slot = s;
+				break;
+			}
+		}
+		if (lifetime.slot == (size_t)-1)
+		{
+			lifetime.slot = slots.size();
+			slots.push_back({ key, 0 });
+			mCompiled.aliasedMemory += size;
+		}
+		slots[lifetime.slot].last = lifetime.last;
+	}
+	mCompiled.numSlots = slots.size();
 }
 
-void RenderGraph::Builder::copy(const ResourceHandle::Ptr& src, const ResourceHandle::Ptr& dst)
+void RenderGraph::planBarriers()
 {
-	if (src)
-		mTransitions.push_back({ src, D3D12_RESOURCE_STATE_COPY_SOURCE, IT_NONE });
-	if (dst)
-		mTransitions.push_back({ src, D3D12_RESOURCE_STATE_COPY_DEST, IT_DISCARD});
+	const uint32_t graphicsBit = 1 << QA_GRAPHICS;
+	const uint32_t computeBit = 1 << QA_COMPUTE;
+	struct Access
+	{
+		D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON;
+		bool write = false;
+		bool fence = false;
+		// bit per queue the accesses come from
+		uint32_t queues = 0;
+		// a lifetime bound to the view
+		size_t resource = 0;
+	};
+	struct Track
+	{
+		bool used = false;
+		size_t level = 0;
+		Access access;
+	};
+
+	auto& lifetimes = mCompiled.lifetimes;
+	std::unordered_map<ResourceHandle*, size_t> indices;
+	for (size_t i = 0; i < lifetimes.size(); ++i)
+		indices[lifetimes[i].handle.get()] = i;
+	// aliased handles share the state of their view
+	auto view = [&](size_t resource) {
+		auto slot = lifetimes[resource].slot;
+		return slot == (size_t)-1 ? resource : lifetimes.size() + slot;
+	};
+
+	auto numLevels = mCompiled.levels.size();
+	auto& graphics = mCompiled.batches[QA_GRAPHICS];
+	auto& compute = mCompiled.batches[QA_COMPUTE];
+	graphics.resize(numLevels);
+	compute.resize(numLevels);
+	// by view and mip
+	std::map<std::pair<size_t, UINT>, Track> tracks;
+	// latest point of the other queue that a queue has waited for, 0 for none
+	auto point = [](size_t level, bool afterPasses) { return level * 2 + afterPasses + 1; };
+	size_t waited[QA_COUNT] = {};
 
+	for (size_t level = 0; level < numLevels; ++level)
+	{
+		// passes of one level run back to back, reads of a mip share one combined read state
+		std::map<std::pair<size_t, UINT>, Access> accesses;
+		for (auto index : mCompiled.levels[level])
+		{
+			auto queue = mCompiled.nodes[index].queue;
+			for (auto& t : mPrepared[index].builder.mTransitions)
+			{
+				auto resource = indices[t.res.get()];
+				auto state = getState(queue, t);
+				for (auto mip = t.mips.first; mip < t.end(); ++mip)
+				{
+					auto& access = accesses[{ view(resource), mip }];
+					access.resource = resource;
+					access.queues |= 1 << queue;
+					if (t.write)
+					{
+						access.state = state;
+						access.write = true;
+					}
+					else if (!access.write)
+						access.state = (D3D12_RESOURCE_STATES)(access.state | state);
+					access.fence = access.fence || (t.type == Builder::IT_FENCE && t.res->getType() == Renderer::VT_UNORDEREDACCESS);
+				}
+
+				// copies overwrite their destination, which cannot be discarded in the copy state anyway
+				if ((t.type == Builder::IT_CLEAR || t.type == Builder::IT_DISCARD) && state != D3D12_RESOURCE_STATE_COPY_DEST)
+					mCompiled.batches[queue][level].initializations.push_back({ resource, t.type, t.mips });
+			}
+		}
+
+		// required[q] is the point of the other queue that q has to wait for before this level
+		size_t required[QA_COUNT] = {};
+		auto require = [&](uint32_t queues, QueueAffinity from, size_t p) {
+			for (int q = 0; q < QA_COUNT; ++q)
+			{
+				if (q != from && (queues & (1 << q)))
+					required[q] = std::max(required[q], p);
+			}
+		};
+
+		for (auto& [id, access] : accesses)
+		{
+			auto& track = tracks[id];
+			auto& prev = track.access;
+			auto resource = access.resource;
+			auto mip = id.second;
+			bool changed = !track.used || prev.state != access.state;
+
+			// accesses of the other queue in earlier levels have to be done
+			if (track.used && (changed || prev.write || access.write))
+			{
+				for (int p = 0; p < QA_COUNT; ++p)
+				{
+					if (prev.queues & (1 << p))
+						require(access.queues, (QueueAffinity)p, point(track.level, true));
+				}
+			}
+
+			if (!track.used)
+			{
+				// only the resource knows its state, one queue reads it so that recording threads do not race.
+				// for compute the graphics queue transitions it at the start of the frame.
+				auto at = access.queues & graphicsBit ? level : 0;
+				graphics[at].barriers.push_back({ CompiledGraph::BT_TRACKED, resource, access.state, access.state, mip });
+				require(access.queues, QA_GRAPHICS, point(at, false));
+			}
+			else if (!changed)
+			{
+				mCompiled.numRedundant++;
+				// unordered accesses of two levels on one queue still need to be ordered, across queues the fence does it
+				bool uav = access.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS && (access.write || prev.write);
+				if ((uav || access.fence) && prev.queues == access.queues && (access.queues == graphicsBit || access.queues == computeBit))
+				{
+					auto queue = access.queues == graphicsBit ? QA_GRAPHICS : QA_COMPUTE;
+					mCompiled.batches[queue][level].barriers.push_back({ CompiledGraph::BT_UAV, resource, access.state, access.state, mip });
+				}
+			}
+			else if (prev.queues == access.queues && (access.queues == graphicsBit || access.queues == computeBit))
+			{
+				auto& batches = access.queues == graphicsBit ? graphics : compute;
+				if (level > track.level + 1)
+				{
+					batches[track.level + 1].barriers.push_back({ CompiledGraph::BT_BEGIN, resource, prev.state, access.state, mip });
+					batches[level].barriers.push_back({ CompiledGraph::BT_END, resource, prev.state, access.state, mip });
+					mCompiled.numSplit++;
+				}
+				else
+					batches[level].barriers.push_back({ CompiledGraph::BT_TRANSITION, resource, prev.state, access.state, mip });
+			}
+			else
+			{
+				// right after graphics users, or as late as possible after compute users
+				auto at = prev.queues & computeBit ? level : track.level + 1;
+				graphics[at].barriers.push_back({ CompiledGraph::BT_TRANSITION, resource, prev.state, access.state, mip });
+				require(access.queues, QA_GRAPHICS, point(at, false));
+				// the transition itself must not start before the compute users are done
+				if (prev.queues & computeBit)
+					require(graphicsBit, QA_COMPUTE, point(track.level, true));
+			}
+
+			track.used = true;
+			track.level = level;
+			track.access = access;
+		}
+
+		for (int q = 0; q < QA_COUNT; ++q)
+		{
+			if (required[q] <= waited[q])
+				continue;
+			waited[q] = required[q];
+			auto other = q == QA_GRAPHICS ? QA_COMPUTE : QA_GRAPHICS;
+			auto l = (required[q] - 1) / 2;
+			bool afterPasses = (required[q] - 1) % 2;
+			mCompiled.batches[q][level].waits.push_back({ other, l, afterPasses });
+			auto& signal = mCompiled.batches[other][l];
+			(afterPasses ? signal.signalPasses : signal.signalBarriers) = true;
+			mCompiled.numCrossQueueWaits++;
+		}
+	}
+
+	// what every mip of a resource does in a batch is done once for all subresources
+	auto numMips = [&](size_t resource) { return lifetimes[resource].handle->getMipLevels(); };
+	for (auto& batches : mCompiled.batches)
+	{
+		for (auto& batch : batches)
+		{
+			using Key = std::tuple<CompiledGraph::BarrierType, size_t, D3D12_RESOURCE_STATES, D3D12_RESOURCE_STATES>;
+			std::map<Key, UINT> counts;
+			for (auto& b : batch.barriers)
+				counts[{ b.type, b.resource, b.before, b.after }]++;
+			std::vector<CompiledGraph::Barrier> merged;
+			for (auto& b : batch.barriers)
+			{
+				auto& count = counts[{ b.type, b.resource, b.before, b.after }];
+				// unordered access barriers are for the whole resource anyway
+				if (b.type != CompiledGraph::BT_UAV && count != numMips(b.resource))
+					merged.push_back(b);
+				else if (count != 0)
+				{
+					merged.push_back(b);
+					merged.back().subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+					count = 0;
+				}
+			}
+			batch.barriers = std::move(merged);
+		}
+	}
+
+	if (numLevels == 0)
+		return;
+	auto& last = graphics[numLevels - 1];
+	std::map<std::pair<size_t, D3D12_RESOURCE_STATES>, UINT> counts;
+	for (auto& [id, track] : tracks)
+		counts[{ track.access.resource, track.access.state }]++;
+	for (auto& [id, track] : tracks)
+	{
+		auto& count = counts[{ track.access.resource, track.access.state }];
+		if (count != numMips(track.access.resource))
+			last.finalStates.push_back({ track.access.resource, id.second, track.access.state });
+		else if (count != 0)
+		{
+			last.finalStates.push_back({ track.access.resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, track.access.state });
+			count = 0;
+		}
+	}
 }
 
-void RenderGraph::Builder::prepare(Renderer::CommandList * cmdlist)const
+D3D12_RESOURCE_STATES RenderGraph::getState(QueueAffinity queue, const Builder::Transition& t)
 {
-	std::vector<ResourceHandle::Ptr> uavBarriers;
-	for (auto& t : mTransitions)
+	if (queue != QA_COMPUTE)
+		return t.state;
+	ASSERT(!t.write || t.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS || t.state == D3D12_RESOURCE_STATE_COPY_DEST,
+		"compute passes can only write unordered access or copy destinations");
+	return t.state == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE ? D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE : t.state;
+}
+
+void RenderGraph::partition()
+{
+	auto numLevels = mCompiled.levels.size();
+
+	// cpu time of last frame's recording, passes never recorded yet are assumed to be average.
+	// only looked up, so that compiling does not need a renderer to make profiles
+	std::vector<float> costs(mPrepared.size(), 0);
+	float known = 0;
+	size_t numKnown = 0;
+	for (auto index : mCompiled.order)
+	{
+		if (!mPrepared[index].task)
+			continue;
+		if (auto profile = ProfileMgr::Singleton.findProfile(mPasses[index].first))
+			costs[index] = profile->getCPUTime();
+		if (costs[index] > 0)
+		{
+			known += costs[index];
+			numKnown++;
+		}
+	}
+	auto average = numKnown ? known / numKnown : 1.0f;
+	for (auto& c : costs)
 	{
-		cmdlist->transitionBarrier(t.res->getView(), t.state,0);
-		if (t.type == IT_FENCE && t.res->getType() == Renderer::VT_UNORDEREDACCESS)
-			uavBarriers.emplace_back(t.res);
+		if (c <= 0)
+			c = average;
 	}
 
-	for (auto& t : uavBarriers)
+	auto budget = mMaxCommandLists ? mMaxCommandLists : std::max<size_t>(1, std::thread::hardware_concurrency());
+	for (int q = 0; q < QA_COUNT; ++q)
 	{
-		cmdlist->uavBarrier(t->getView());
+		// waits and signals sit between command lists, so they cut the queue into segments
+		struct Segment
+		{
+			CompiledGraph::Group group;
+			size_t numPasses = 0;
+			size_t numGroups = 1;
+		};
+		std::vector<Segment> segments(1);
+		auto cut = [&]() {
+			auto& g = segments.back().group;
+			if (!g.items.empty() || !g.waits.empty() || !g.signals.empty())
+				segments.emplace_back();
+		};
+
+		for (size_t level = 0; level < numLevels; ++level)
+		{
+			auto& batch = mCompiled.batches[q][level];
+			if (!batch.waits.empty())
+			{
+				if (!segments.back().group.items.empty())
+					cut();
+				auto& waits = segments.back().group.waits;
+				waits.insert(waits.end(), batch.waits.begin(), batch.waits.end());
+			}
+			if (!batch.barriers.empty() || !batch.initializations.empty() || !batch.finalStates.empty())
+				segments.back().group.items.push_back({ level, -1 });
+			if (batch.signalBarriers)
+			{
+				segments.back().group.signals.push_back({ (QueueAffinity)q, level, false });
+				cut();
+			}
+
+			for (auto index : mCompiled.levels[level])
+			{
+				// passes without a task have nothing to record
+				if (mCompiled.nodes[index].queue != q || !mPrepared[index].task)
+					continue;
+				auto& segment = segments.back();
+				segment.group.items.push_back({ level, index });
+				segment.group.cost += costs[index];
+				segment.numPasses++;
+			}
+			if (batch.signalPasses)
+			{
+				segments.back().group.signals.push_back({ (QueueAffinity)q, level, true });
+				cut();
+			}
+		}
+		auto& tail = segments.back().group;
+		if (tail.items.empty() && tail.waits.empty() && tail.signals.empty())
+			segments.pop_back();
+
+		// every segment takes one command list, the rest go to the most expensive per list
+		for (size_t extra = budget > segments.size() ? budget - segments.size() : 0; extra > 0; --extra)
+		{
+			Segment* best = nullptr;
+			for (auto& segment : segments)
+			{
+				if (segment.numGroups >= segment.numPasses)
+					continue;
+				if (!best || segment.group.cost / segment.numGroups > best->group.cost / best->numGroups)
+					best = &segment;
+			}
+			if (!best)
+				break;
+			best->numGroups++;
+		}
+
+		auto& groups = mCompiled.groups[q];
+		for (auto& segment : segments)
+		{
+			auto& source = segment.group;
+			auto target = source.cost / segment.numGroups;
+			float sum = 0;
+			size_t made = 0;
+			groups.emplace_back();
+			groups.back().waits = source.waits;
+			for (size_t i = 0; i < source.items.size(); ++i)
+			{
+				auto [level, index] = source.items[i];
+				auto& group = groups.back();
+				group.items.push_back({ level, index });
+				if (index == (size_t)-1)
+				{
+					auto& batch = mCompiled.batches[q][level];
+					auto tracked = std::any_of(batch.barriers.begin(), batch.barriers.end(), [](auto& b) {
+						return b.type == CompiledGraph::BT_TRACKED;
+					});
+					group.strand = group.strand || tracked || !batch.finalStates.empty();
+					continue;
+				}
+
+				sum += costs[index];
+				group.cost += costs[index];
+				if (i + 1 == source.items.size())
+					continue;
+				// only cut after passes, a batch stays in front of the passes of its level
+				if (made + 1 < segment.numGroups && sum >= target * (made + 1))
+				{
+					groups.emplace_back();
+					made++;
+				}
+				// the list of a barrier is submitted as soon as its producers are done
+				else if (std::binary_search(mBarrierPasses.begin(), mBarrierPasses.end(), index))
+					groups.emplace_back();
+			}
+			groups.back().signals = source.signals;
+		}
 	}
+}
 
+template<class CommandList, class Views>
+void RenderGraph::recordBatch(CommandList* cmdlist, const CompiledGraph::Batch& batch, const std::vector<ResourceHandle::Ptr>& handles, Views&& views)
+{
+	for (auto& b : batch.barriers)
+	{
+		auto&& view = views(b.resource);
+		switch (b.type)
+		{
+		case CompiledGraph::BT_TRACKED: cmdlist->transitionBarrier(view, b.after, b.subresource); break;
+		case CompiledGraph::BT_TRANSITION: cmdlist->transition(view, b.before, b.after, b.subresource); break;
+		case CompiledGraph::BT_BEGIN: cmdlist->beginTransition(view, b.before, b.after, b.subresource); break;
+		case CompiledGraph::BT_END: cmdlist->endTransition(view, b.before, b.after, b.subresource); break;
+		case CompiledGraph::BT_UAV: cmdlist->uavBarrier(view); break;
+		}
+	}
 	cmdlist->flushResourceBarrier();
 
+	// explicit transitions do not touch the recorded states, every tracked one has been recorded by now
+	for (auto& f : batch.finalStates)
+		views(f.resource)->setState(f.state, f.subresource);
 
-	for (auto& t : mTransitions)
+	for (auto& init : batch.initializations)
 	{
-		auto res = t.res->getView();
-		auto& cv = t.res->getClearValue();
-		if (t.type == IT_CLEAR)
+		auto& handle = handles[init.resource];
+		auto&& res = views(init.resource);
+		auto& cv = handle->getClearValue();
+		if (init.type == Builder::IT_CLEAR)
 		{
 			switch (res->getViewType())
 			{
-			case Renderer::VT_RENDERTARGET: cmdlist->clearRenderTarget(res, cv.color); break;
+			case Renderer::VT_RENDERTARGET: 
+				{
+					for (auto mip = init.mips.first; mip < init.mips.end(handle->getMipLevels()); ++mip)
+						cmdlist->clearRenderTarget(res, cv.color, mip);
+					break;
+				}
 			case Renderer::VT_DEPTHSTENCIL: cmdlist->clearDepthStencil(res, cv.depth, cv.stencil); break;
+			default: break;
 			}
 		}
-		else if (t.type == IT_DISCARD)
+		else
+			cmdlist->discardResource(res, init.mips.first, init.mips.count);
+	}
+}
+
+RenderGraph::Simulation RenderGraph::simulate(const UniqueFunction<float(size_t)>& cost) const
+{
+	Simulation sim;
+	if (!mIsCompiled)
+		return sim;
+
+	float clocks[QA_COUNT] = {};
+	float busy[QA_COUNT] = {};
+	std::map<std::tuple<int, size_t, bool>, float> signals;
+	for (size_t level = 0; level < mCompiled.levels.size(); ++level)
+	{
+		// graphics first, compute waits for graphics barriers of the same level
+		for (int q = 0; q < QA_COUNT; ++q)
 		{
-			cmdlist->discardResource(res);
+			auto& batch = mCompiled.batches[q][level];
+			for (auto& w : batch.waits)
+				clocks[q] = std::max(clocks[q], signals[{ w.queue, w.level, w.afterPasses }]);
+			if (batch.signalBarriers)
+				signals[{ q, level, false }] = clocks[q];
+			for (auto index : mCompiled.levels[level])
+			{
+				if (mCompiled.nodes[index].queue != q)
+					continue;
+				auto c = cost ? cost(index) : 1.0f;
+				clocks[q] += c;
+				busy[q] += c;
+			}
+			if (batch.signalPasses)
+				signals[{ q, level, true }] = clocks[q];
 		}
 	}
+
+	sim.graphicsTime = busy[QA_GRAPHICS];
+	sim.computeTime = busy[QA_COMPUTE];
+	sim.makespan = std::max(clocks[QA_GRAPHICS], clocks[QA_COMPUTE]);
+	// a queue only ever waits for the other one to make progress, so one of them is always busy
+	sim.overlap = sim.graphicsTime + sim.computeTime - sim.makespan;
+	return sim;
 }
 
+void RenderGraph::bindTransients()
+{
+	// a reused plan keeps the views of its slots
+	if (mCacheHit)
+	{
+		for (auto& h : mBoundHandles)
+			h->unbindView();
+		mBoundHandles.clear();
+	}
+	else
+		releaseTransients();
 
-void RenderGraph::Barrier::signal()
+	mTransientViews.resize(mCompiled.numSlots);
+	for (auto& lifetime : mCompiled.lifetimes)
+	{
+		if (lifetime.slot == (size_t)-1)
+			continue;
+		auto& view = mTransientViews[lifetime.slot];
+		if (!view.first)
+			view = lifetime.handle->allocate();
+		lifetime.handle->bindView(view.first);
+		mBoundHandles.push_back(lifetime.handle);
+	}
+}
+
+void RenderGraph::releaseTransients()
 {
-	mFence->signal();
+	for (auto& h : mBoundHandles)
+		h->unbindView();
+	mBoundHandles.clear();
+
+	// reversed so that the pool hands the same views to the same slots next frame
+	for (auto i = mTransientViews.rbegin(); i != mTransientViews.rend(); ++i)
+	{
+		if (i->first)
+			ResourceViewAllocator::Singleton.recycle(i->first, i->second);
+	}
+	mTransientViews.clear();
 }
 
-void RenderGraph::Barrier::addRenderTask(const std::string& name, RenderPass&& callback)
+void RenderGraph::visitGroups(const std::function<void(QueueAffinity, const CompiledGraph::Group&)>& visitor) const
 {
-	std::lock_guard<std::mutex> lock(mMutex);
-	mPasses->push_back({ name, std::move(callback) });
+	std::set<std::tuple<int, size_t, bool>> signalled;
+	size_t next[QA_COUNT] = {};
+	auto ready = [&](const CompiledGraph::Group& group) {
+		return std::all_of(group.waits.begin(), group.waits.end(), [&](auto& w) {
+			return signalled.count({ w.queue, w.level, w.afterPasses }) != 0;
+		});
+	};
 
+	// a queue goes on until it waits for a point the other queue has not reached yet
+	bool progress = true;
+	while (progress)
+	{
+		progress = false;
+		for (int q = 0; q < QA_COUNT; ++q)
+		{
+			auto& groups = mCompiled.groups[q];
+			for (; next[q] < groups.size() && ready(groups[next[q]]); ++next[q])
+			{
+				auto& group = groups[next[q]];
+				visitor((QueueAffinity)q, group);
+				for (auto& s : group.signals)
+					signalled.insert({ s.queue, s.level, s.afterPasses });
+				progress = true;
+			}
+		}
+	}
+	// checked in release builds too, the groups left out would never be recorded or validated
+	for (int q = 0; q < QA_COUNT; ++q)
+	{
+		if (next[q] != mCompiled.groups[q].size())
+		{
+			LOG("render graph waits for a point that is never signalled");
+			std::terminate();
+		}
+	}
 }
 
+#if !defined(_HEADLESS)
+void RenderGraph::execute(Renderer::CommandQueue::Ref queue)
+{
+	execute(queue, {});
+}
 
-RenderGraph::Barrier::Barrier()
+void RenderGraph::execute(Renderer::CommandQueue::Ref queue, Renderer::CommandQueue::Ref compute)
 {
-	mFence = FenceObject::Ptr(new FenceObject());
-	mPasses = decltype(mPasses)(new Passes());
+	CHECK_RENDER_THREAD;
+
+	// views released by the last frame are pooled by now
+	ResourceViewAllocator::Singleton.trim();
+	{
+		std::vector<std::string> names;
+		{
+			std::lock_guard<std::mutex> lock(mMissingProfiles->mutex);
+			names.swap(mMissingProfiles->names);
+		}
+		for (auto& name : names)
+			ProfileMgr::Singleton.getProfile(name);
+	}
+	compile(compute != nullptr);
+	if (mValidation)
+	{
+		for (auto& e : validate(compute != nullptr))
+			LOG("render graph: " + e);
+	}
+	bindTransients();
+
+	// recording outlives this call, the command lists share the plan and the tasks
+	struct Frame
+	{
+		std::vector<ResourceHandle::Ptr> handles;
+		std::array<std::vector<CompiledGraph::Batch>, QA_COUNT> batches;
+		std::vector<RenderTask> tasks;
+		std::vector<Renderer::Profile::Ref> profiles;
+	};
+	auto frame = std::make_shared<Frame>();
+	for (auto& lifetime : mCompiled.lifetimes)
+		frame->handles.push_back(lifetime.handle);
+	for (int q = 0; q < QA_COUNT; ++q)
+		frame->batches[q] = mCompiled.batches[q];
+	frame->profiles.resize(mPrepared.size());
+	for (size_t i = 0; i < mPrepared.size(); ++i)
+	{
+		frame->tasks.push_back(std::move(mPrepared[i].task));
+		if (frame->tasks.back())
+			frame->profiles[i] = ProfileMgr::Singleton.getProfile(mPasses[i].first);
+	}
+
+	Renderer::CommandQueue::Ref queues[QA_COUNT] = { queue, compute };
+	std::map<std::tuple<int, size_t, bool>, Renderer::CommandQueue::SyncPoint::Ptr> signals;
+	visitGroups([&](QueueAffinity q, const CompiledGraph::Group& group) {
+		auto& target = queues[q];
+		if (!target)
+			return;
+		for (auto& w : group.waits)
+			target->addWait(signals[{ w.queue, w.level, w.afterPasses }]);
+
+		if (!group.items.empty())
+		{
+			target->addCoroutineCommand([frame, q, items = group.items](Renderer::CommandList* cmdlist)->Future<Promise>
+			{
+				auto data = frame;
+				auto queue = q;
+				auto work = items;
+				// the passes copy their captures before they suspend
+				std::vector<Coroutine<Promise>> passes;
+				passes.reserve(work.size());
+				for (auto& item : work)
+				{
+					if (item.second != (size_t)-1)
+						passes.emplace_back(data->tasks[item.second], cmdlist);
+				}
+
+				co_await std::suspend_always();
+
+				auto pass = passes.begin();
+				for (auto& item : work)
+				{
+					if (item.second == (size_t)-1)
+					{
+						recordBatch(cmdlist, data->batches[queue][item.first], data->handles, [&](size_t resource) -> const Renderer::Resource::Ref& {
+							return data->handles[resource]->getView();
+						});
+						continue;
+					}
+
+					auto& co = *pass++;
+					auto& profile = data->profiles[item.second];
+					bool started = false;
+					while (!co.done())
+					{
+						co_await co.yield();
+						if (!started)
+							profile->begin(cmdlist);
+						started = true;
+						co.resume();
+					}
+					if (started)
+						profile->end(cmdlist);
+				}
+				co_return;
+			}, group.strand);
+		}
+
+		for (auto& s : group.signals)
+			signals[{ s.queue, s.level, s.afterPasses }] = target->addSignal();
+	});
+
+	advanceHistories();
+
+	// setups run again next frame
+	mPrepared.clear();
+	mIsCompiled = false;
 }
 
-void RenderGraph::Barrier::execute()
+#endif
+
+std::vector<std::string> RenderGraph::validate(bool asyncCompute)
 {
-	//mFence->wait();
+	CHECK_RENDER_THREAD;
+	compile(asyncCompute);
+
+	HazardValidator validator;
+	auto& lifetimes = mCompiled.lifetimes;
+	std::vector<ResourceHandle::Ptr> handles;
+	for (auto& lifetime : lifetimes)
+		handles.push_back(lifetime.handle);
+	// aliased handles share one view, like the views bound by bindTransients()
+	std::vector<HazardValidator::View*> views(lifetimes.size() + mCompiled.numSlots);
+	auto view = [&](size_t resource) {
+		auto slot = lifetimes[resource].slot;
+		auto& v = views[slot == (size_t)-1 ? resource : lifetimes.size() + slot];
+		if (!v)
+		{
+			auto& handle = lifetimes[resource].handle;
+			auto name = handle->getName().empty() ? "handle " + std::to_string(resource) : Common::convert(handle->getName());
+			v = validator.addView(name, handle->getType(), handle->getMipLevels());
+		}
+		return v;
+	};
+	std::unordered_map<ResourceHandle*, size_t> indices;
+	for (size_t i = 0; i < lifetimes.size(); ++i)
+		indices[lifetimes[i].handle.get()] = i;
+	auto point = [](const CompiledGraph::Sync& s) { return s.level * 2 + s.afterPasses; };
+
+	visitGroups([&](QueueAffinity q, const CompiledGraph::Group& group) {
+		for (auto& w : group.waits)
+			validator.wait(q, w.queue, point(w));
 
-	//auto r = Renderer::getSingleton();
-	//std::lock_guard<std::mutex> lock(mMutex);
-	//r->addRenderTask([fence = mFence, passes = mPasses](auto cmdlist)mutable {
-	//	PROFILE("barrier", {});
-	//	{
-	//		PROFILE("barrier waitting", {});
-	//		fence->wait();
-	//	}
-	//	while(!tasks->empty())
-	//	{
-	//		auto& t = tasks->front();
-	//		PROFILE(t.first, cmdlist);
-	//		t.second(cmdlist);
-	//		tasks->pop_front();
-	//	}
-	//});
+		HazardValidator::CommandList cmdlist(validator, q);
+		for (auto& [level, index] : group.items)
+		{
+			if (index == (size_t)-1)
+			{
+				recordBatch(&cmdlist, mCompiled.batches[q][level], handles, view);
+				continue;
+			}
+			for (auto& t : mPrepared[index].builder.mTransitions)
+			{
+				auto v = view(indices[t.res.get()]);
+				for (auto mip = t.mips.first; mip < t.end(); ++mip)
+					validator.access(q, v, mip, getState(q, t), t.write, mPasses[index].first);
+			}
+		}
+
+		for (auto& s : group.signals)
+			validator.signal(q, point(s));
+	});
+
+	return validator.getErrors();
+}
+
+void RenderGraph::reset()
+{
+	mPasses.clear();
+	mBarrierPasses.clear();
+	mPrepared.clear();
+	mIsCompiled = false;
+}
+
+
+void RenderGraph::Builder::read(const ResourceHandle::Ptr& res, MipRange mips)
+{
+	ASSERT(mips.first < res->getMipLevels(), "mip range is out of the handle");
+	mTransitions.push_back({res, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, IT_NONE, true, false, mips});
+}
+
+void RenderGraph::Builder::write(const ResourceHandle::Ptr& res, InitialType type, MipRange mips)
+{
+	ASSERT(mips.first < res->getMipLevels(), "mip range is out of the handle");
+	if (res->getType() == Renderer::VT_DEPTHSTENCIL)
+		mTransitions.push_back({res, D3D12_RESOURCE_STATE_DEPTH_WRITE , type, false, true, mips});
+	else
+		mTransitions.push_back({ res, D3D12_RESOURCE_STATE_RENDER_TARGET , type, false, true, mips });
+}
+
+void RenderGraph::Builder::access(const ResourceHandle::Ptr& res, InitialType type, MipRange mips)
+{
+	ASSERT(mips.first < res->getMipLevels(), "mip range is out of the handle");
+	mTransitions.push_back({res, D3D12_RESOURCE_STATE_UNORDERED_ACCESS , type, true, true, mips });
+}
+
+void RenderGraph::Builder::copy(const ResourceHandle::Ptr& src, const ResourceHandle::Ptr& dst)
+{
+	if (src)
+		mTransitions.push_back({ src, D3D12_RESOURCE_STATE_COPY_SOURCE, IT_NONE, true, false, {} });
+	if (dst)
+		mTransitions.push_back({ dst, D3D12_RESOURCE_STATE_COPY_DEST, IT_DISCARD, false, true, {} });
+
+}
+
+void RenderGraph::Barrier::signal()
+{
+	mSignalled.set();
+	mArrived.set();
+}
+
+void RenderGraph::Barrier::addRenderTask(const std::string& name, RenderPass&& callback)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPasses.push_back({ name, std::move(callback) });
+	}
+	mArrived.set();
 }
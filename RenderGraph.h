@@ -1,14 +1,29 @@
 #pragma once 
 
+#if defined(_HEADLESS)
+#include "NullRenderer.h"
+#else
 #include "Common.h"
 #include "Renderer.h"
+#endif
 #include "Fence.h"
+#include "TaskExecutor.h"
 
 class ResourceHandle
 {
+	friend class RenderGraph;
 public:
 	using Ptr = std::shared_ptr<ResourceHandle>;
 
+	struct MipRange
+	{
+		UINT first = 0;
+		// -1 for the mips up to the last one
+		UINT count = -1;
+
+		UINT end(UINT numMips)const{return std::min(numMips, count == (UINT)-1 ? count : first + count);}
+	};
+
 	static ResourceHandle::Ptr create(Renderer::ViewType type, int w, int h, DXGI_FORMAT format, Renderer::ClearValue cv);
 	static ResourceHandle::Ptr create(Renderer::ViewType type, int w, int h, int d, DXGI_FORMAT format, Renderer::ClearValue cv);
 
@@ -21,19 +36,37 @@ public:
 	const std::wstring& getName()const;
 	void setName(const std::wstring& n);
 	const Renderer::ClearValue& getClearValue()const{return mClearValue;};
+	// imported resources outlive the frame, so the render graph never culls their writers
+	void setImported(bool imported){mImported = imported;}
+	bool isImported()const{return mImported;}
+	// before the view is allocated, clamped to the full chain. views of index i in the view are bound to mip i
+	void setMipLevels(UINT mips);
+	UINT getMipLevels()const{return mMips;}
 
 	void prepare();
 	const Renderer::Resource::Ref& getView() ;
+	// estimated video memory of the view
+	size_t getSize()const;
 private:
+	std::pair<Renderer::Resource::Ref, size_t> allocate()const;
+	size_t getPoolKey()const;
+	// transient handles borrow a view owned by the render graph for one frame
+	void bindView(const Renderer::Resource::Ref& view);
+	void unbindView();
+	// gives an owned view back to the pool, the next getView() allocates again
+	void releaseView();
 	std::wstring mName;
 	Renderer::ViewType mType;
 	int mWidth;
 	int mHeight;
 	int mDepth;
+	UINT mMips = 1;
 	DXGI_FORMAT mFormat;
 	Renderer::Resource::Ref mView;
 	Renderer::ClearValue mClearValue = {};
 	size_t mHashValue = 0;
+	bool mImported = false;
+	bool mBound = false;
 	std::mutex mViewMutex;
 };
 
@@ -41,10 +74,19 @@ private:
 class RenderGraph
 {
 public:
-	using RenderTask = std::function<Future<Promise>(Renderer::CommandList *)>;
+	using RenderTask = UniqueFunction<Future<Promise>(Renderer::CommandList *)>;
+
+	enum QueueAffinity
+	{
+		QA_GRAPHICS,
+		// async compute, runs on the graphics queue when no compute queue is given
+		QA_COMPUTE,
+		QA_COUNT,
+	};
 
 	class Builder
 	{
+		friend class RenderGraph;
 	public:
 		enum InitialType
 		{
@@ -53,13 +95,18 @@ public:
 			IT_DISCARD,
 			IT_FENCE,
 		};
+
+		// passes can read one mip of a handle while others write the next
+		using MipRange = ResourceHandle::MipRange;
 	
-		void read(const ResourceHandle::Ptr& res);
-		void write(const ResourceHandle::Ptr& res, InitialType type);
-		void access(const ResourceHandle::Ptr& res, InitialType type = IT_NONE);
+		// clears and discards only initialize the mips in the range, depth stencils clear their first mip
+		void read(const ResourceHandle::Ptr& res, MipRange mips = {});
+		void write(const ResourceHandle::Ptr& res, InitialType type, MipRange mips = {});
+		void access(const ResourceHandle::Ptr& res, InitialType type = IT_NONE, MipRange mips = {});
 		void copy(const ResourceHandle::Ptr& src, const ResourceHandle::Ptr& dst);
+		// compute passes read as non pixel shader resources and write only unordered access or copy destinations
+		void setAffinity(QueueAffinity affinity){mAffinity = affinity;}
 
-		void prepare(Renderer::CommandList * cmdlist)const;
 		bool empty(){return mTransitions.empty();}
 	private:
 		struct Transition
@@ -67,41 +114,304 @@ public:
 			ResourceHandle::Ptr res;
 			D3D12_RESOURCE_STATES state;
 			InitialType type;
+			bool read;
+			bool write;
+			MipRange mips;
+
+			UINT end()const{return mips.end(res->getMipLevels());}
 		};
 		std::vector<Transition> mTransitions;
+		QueueAffinity mAffinity = QA_GRAPHICS;
 		//std::vector<ResourceHandle::Ptr> mUAVBarriers;
 	};
 
-	using RenderPass = std::function<RenderTask(Builder&)>;
+	using RenderPass = UniqueFunction<RenderTask(Builder&)>;
 
 
+	// passes streamed in by other threads, e.g. the scene traversal, while the graph is already recording.
+	// they are recorded in the order they are added into the command list of the barrier pass, which closes
+	// once signal() is called and all of them are recorded. it waits without blocking a worker, but signal()
+	// has to be called every frame or the frame never finishes.
 	class Barrier
 	{
+		friend class RenderGraph;
 	public:
 		using Ptr = std::shared_ptr<Barrier>;
-		using BarrierTask = std::function<void(Barrier*)>;
-		Barrier();
 
-		void execute();
 		void signal();
-
+		// thread safe, the setup runs on the recording thread and may only use what the barrier declared
 		void addRenderTask(const std::string& name, RenderPass&& callback);
 	private:
-		FenceObject::Ptr mFence ;
 		using Passes = std::vector<std::pair<std::string, RenderPass>>;
-		std::shared_ptr<Passes> mPasses;
+		Passes mPasses;
 		std::mutex mMutex;
+		AwaitableFlag mSignalled;
+		// set by every new pass and the signal, reset before the recorder looks for more
+		AwaitableFlag mArrived;
 	};
 
-public:
+	// contents carried into the next frame, e.g. for temporal effects. passes write getCurrent() and read
+	// getPrevious(), the graph swaps the two handles after every frame. both are imported, so their states
+	// are handed over through the views, and their views go back to the pool once no pass used them for
+	// a while.
+	class History
+	{
+		friend class RenderGraph;
+	public:
+		using Ptr = std::shared_ptr<History>;
+
+		const ResourceHandle::Ptr& getCurrent()const{return mHandles[mCurrent];}
+		const ResourceHandle::Ptr& getPrevious()const{return mHandles[mCurrent ^ 1];}
+		// whether last frame wrote what getPrevious() holds, false on the first frame and after a release
+		bool hasPrevious()const{return mValid;}
+	private:
+		ResourceHandle::Ptr mHandles[2];
+		size_t mCurrent = 0;
+		bool mValid = false;
+		// frames in a row no pass used either handle
+		size_t mUnused = 0;
+	};
+
+	// result of compile(), passes are referred to by their insertion index
+	struct CompiledGraph
+	{
+		struct Node
+		{
+			// edges between surviving passes only
+			std::vector<size_t> predecessors;
+			std::vector<size_t> successors;
+			// length of the longest dependency chain leading to the pass
+			size_t level = 0;
+			bool culled = false;
+			QueueAffinity queue = QA_GRAPHICS;
+		};
+
+		std::vector<Node> nodes;
+		// surviving passes by level, then by insertion
+		std::vector<size_t> order;
+		// passes of one level do not depend on each other
+		std::vector<std::vector<size_t>> levels;
+		size_t numCulled = 0;
+
+		// lifetime of a handle in levels, the barriers of a level are recorded before all of its passes,
+		// so handles can only share a view if they are used in different levels
+		struct Lifetime
+		{
+			ResourceHandle::Ptr handle;
+			size_t first = 0;
+			size_t last = 0;
+			// view shared with other transients, -1 if the handle keeps its own view
+			size_t slot = -1;
+		};
+		// handles used by surviving passes, by first use
+		std::vector<Lifetime> lifetimes;
+		size_t numSlots = 0;
+		// bytes of transient views without aliasing and with it
+		size_t transientMemory = 0;
+		size_t aliasedMemory = 0;
+
+		enum BarrierType
+		{
+			// from the state recorded in the resource, used on the first access of a frame
+			BT_TRACKED,
+			BT_TRANSITION,
+			// split transition, the resource is idle from begin to end
+			BT_BEGIN,
+			BT_END,
+			BT_UAV,
+		};
+
+		struct Barrier
+		{
+			BarrierType type;
+			// index into lifetimes
+			size_t resource;
+			D3D12_RESOURCE_STATES before;
+			D3D12_RESOURCE_STATES after;
+			// a mip, or all of them if every mip makes the same transition
+			UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+		};
+
+		struct Initialization
+		{
+			// index into lifetimes
+			size_t resource;
+			Builder::InitialType type;
+			Builder::MipRange mips;
+		};
+
+		struct FinalState
+		{
+			size_t resource;
+			UINT subresource;
+			D3D12_RESOURCE_STATES state;
+		};
+
+		// a point in the command stream of a queue, after the barriers or after the passes of a level
+		struct Sync
+		{
+			QueueAffinity queue;
+			size_t level;
+			bool afterPasses;
+		};
+
+		struct Batch
+		{
+			// waits for the other queue, before the barriers
+			std::vector<Sync> waits;
+			std::vector<Barrier> barriers;
+			// clears and discards recorded after the barriers
+			std::vector<Initialization> initializations;
+			// states the resources are left in, the last graphics batch hands them to the resources
+			std::vector<FinalState> finalStates;
+			// whether the other queue waits for this level
+			bool signalBarriers = false;
+			bool signalPasses = false;
+		};
+		// batches[queue][i] is recorded once before the passes of levels[i] on that queue.
+		// transitions between the queues are recorded on the graphics queue, which handles every state.
+		std::vector<Batch> batches[QA_COUNT];
+		// transitions skipped because the state does not change between levels
+		size_t numRedundant = 0;
+		size_t numSplit = 0;
+		size_t numCrossQueueWaits = 0;
+		bool asyncCompute = false;
+
+		// consecutive batches and passes of one queue recorded into one command list
+		struct Group
+		{
+			// submitted before the group
+			std::vector<Sync> waits;
+			// (level, pass), pass -1 is the barrier batch of the level
+			std::vector<std::pair<size_t, size_t>> items;
+			// points of this queue reached after the group
+			std::vector<Sync> signals;
+			// estimated from last frame's profiles
+			float cost = 0;
+			// groups touching the states recorded in resources are recorded in order
+			bool strand = false;
+		};
+		// groups[queue] in submission order, they are recorded in parallel
+		std::vector<Group> groups[QA_COUNT];
+
+		// passes, their accesses and the descriptors of the handles, the plan is reused while it matches
+		std::string structureKey;
+		size_t structureHash = 0;
+	};
 
+	struct CacheStats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+	};
+
+	// time each queue spends on passes when both start together and honor the waits of the graph
+	struct Simulation
+	{
+		float graphicsTime = 0;
+		float computeTime = 0;
+		float makespan = 0;
+		// time both queues are busy at once
+		float overlap = 0;
+	};
+
+public:
+	~RenderGraph();
 
 	void addPass(const std::string& name, RenderPass&& callback );
-	Barrier::Ptr addBarrier(const std::string& name);
+	// two handles like desc, the graph keeps them only as long as the caller does
+	History::Ptr createHistory(const ResourceHandle::Ptr& desc);
+	// histories unused for this many frames release their views
+	void setHistoryLifetime(size_t frames){mHistoryLifetime = frames;}
+	// the setup declares everything the streamed passes use, the graph plans them like one pass
+	Barrier::Ptr addBarrier(const std::string& name, UniqueFunction<void(Builder&)>&& setup = {});
+	// runs the setup of every pass and builds the dependency graph, execute() reuses it in the same frame.
+	// a pass is culled if nothing it writes reaches a pass without writes (e.g. present) or an imported resource.
+	// handles that are not imported and start with a clear or discard are transient, those whose lifetimes
+	// do not overlap share one pooled view.
+	// transitions are batched once per level, with split barriers over levels where a resource is idle.
+	// without async compute every pass goes to the graphics queue.
+	// the setups still run every frame, if the structure is the same as last frame's the plan and the views
+	// of the transients are kept and only the command lists are repartitioned.
+	const CompiledGraph& compile(bool asyncCompute = true);
+	// replays the compiled graph with a cost per pass (1 if empty), e.g. timings from the last frames
+	Simulation simulate(const UniqueFunction<float(size_t)>& cost = {})const;
+#if !defined(_HEADLESS)
 	void execute(Renderer::CommandQueue::Ref queue);
+	// passes with compute affinity go to the compute queue, both queues have to be executed together
+	void execute(Renderer::CommandQueue::Ref queue, Renderer::CommandQueue::Ref compute);
+#endif
+	// the cached plan survives, the next frame reuses it if it adds the same passes again
 	void reset();
+
+	// replays the plan of the frame against a recording command list without a device, returns the hazards it finds:
+	// accesses not ordered after the writes they depend on, subresources in other states than the passes declare,
+	// and unordered accesses without a uav barrier between them
+	std::vector<std::string> validate(bool asyncCompute = true);
+	// execute() logs what validate() finds, and barriers log the streamed passes that use what they did not declare
+	void setValidation(bool enable){mValidation = enable;}
+
+	// setups run concurrently on the workers, each into its own builder, so the compiled graph is the same
+	// as after serial setups. off by default, only enable it if no setup of the graph touches shared state:
+	// e.g. the setup of the present pass takes the back buffer and the view of its source from the renderer,
+	// and the ImGui pass builds its device objects on first use
+	void setParallelSetup(bool enable){mParallelSetup = enable;}
+
+	// command lists per queue and frame the passes are packed into, 0 for one per hardware thread
+	void setMaxCommandLists(size_t count){mMaxCommandLists = count; mIsCompiled = false;}
+
+	size_t getNumPasses()const{return mPasses.size();}
+	const std::string& getPassName(size_t index)const{return mPasses[index].first;}
+	const CacheStats& getCacheStats()const{return mCacheStats;}
 private:
+	struct PreparedPass
+	{
+		Builder builder;
+		RenderTask task;
+	};
+
+	std::string getStructureKey(bool asyncCompute)const;
+	void computeLifetimes();
+	void planBarriers();
+	void partition();
+	// views(resource) gives the view of a lifetime, the hazard validator records into its stand-ins
+	template<class CommandList, class Views>
+	static void recordBatch(CommandList* cmdlist, const CompiledGraph::Batch& batch, const std::vector<ResourceHandle::Ptr>& handles, Views&& views);
+	// groups of both queues in an order where every wait comes after its signal
+	void visitGroups(const std::function<void(QueueAffinity, const CompiledGraph::Group&)>& visitor)const;
+	// the state a pass declares, as the queue sees it
+	static D3D12_RESOURCE_STATES getState(QueueAffinity queue, const Builder::Transition& t);
+	void bindTransients();
+	void releaseTransients();
+	// swaps the histories at the end of a frame
+	void advanceHistories();
+	// names of streamed passes recorded without a profile, workers only look profiles up
+	// and execute() makes the missing ones on the render thread
+	struct MissingProfiles
+	{
+		std::mutex mutex;
+		std::vector<std::string> names;
+	};
+	static Future<Promise> recordBarrier(Barrier::Ptr barrier, std::vector<Builder::Transition> declared, bool validation, std::shared_ptr<MissingProfiles> missing, Renderer::CommandList* cmdlist);
 
 	std::vector<std::pair<std::string,RenderPass>> mPasses;
+	std::vector<PreparedPass> mPrepared;
+	// passes added by addBarrier(), their command lists close right after them
+	std::vector<size_t> mBarrierPasses;
+	CompiledGraph mCompiled;
+	bool mIsCompiled = false;
+	size_t mMaxCommandLists = 0;
+	bool mParallelSetup = false;
+	TaskExecutor mSetupExecutor{ Dispatcher::getSharedContext() };
+	// the plan of last frame was reused
+	bool mCacheHit = false;
+	CacheStats mCacheStats;
+	bool mValidation = false;
+	std::shared_ptr<MissingProfiles> mMissingProfiles = std::make_shared<MissingProfiles>();
+	// views of the slots bound in the last execute()
+	std::vector<std::pair<Renderer::Resource::Ref, size_t>> mTransientViews;
+	std::vector<ResourceHandle::Ptr> mBoundHandles;
+	std::vector<std::weak_ptr<History>> mHistories;
+	size_t mHistoryLifetime = 3;
 };
 
@@ -2,6 +2,7 @@
 #include "Profile.h"
 #include "Fence.h"
 #include "TaskExecutor.h"
+#include "ThreadTopology.h"
 
 #pragma comment(lib,"d3d12.lib")
 #pragma comment(lib,"dxgi.lib")
@@ -141,6 +142,9 @@ void Renderer::endFrame()
 	ProfileMgr::Singleton.end(mRenderProfile, CommandQueue::CommandListWrapper(mRenderQueue.get()));
 
 	processTasks();
+	// the render queue waits for the compute queue at the end of processTasks, so this covers both
+	mFrameFence->signal(mRenderQueue->get());
+	mFrameNumber++;
 
 	present();
 
@@ -152,7 +156,11 @@ void Renderer::endFrame()
 
 	processRecycle();
 
+	processStreamingTextures();
+
 	processUploadingResource();
+
+	FrameArena::Singleton.nextFrame();
 }
 
 std::array<LONG, 2> Renderer::getSize()
@@ -187,6 +195,11 @@ ID3D12Device* Renderer::getDevice()
 	return mDevice.Get();
 }
 
+Renderer::HeapManager::Ref Renderer::getHeapManager()
+{
+	return mHeapManager;
+}
+
 Renderer::CommandQueue::Ref Renderer::getRenderQueue()
 {
 	return mRenderQueue;
@@ -207,26 +220,51 @@ UINT Renderer::getCurrentFrameIndex()
 	return mCurrentFrame;
 }
 
+UINT64 Renderer::getFrameNumber() const
+{
+	return mFrameNumber.load(std::memory_order_relaxed);
+}
 
-void Renderer::updateResource(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT)>& copy)
+UINT64 Renderer::getCompletedFrame()
+{
+	return mFrameFence->getCompletedValue();
+}
+
+
+void Renderer::updateResource(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT64, UINT)>& copy)
+{
+	auto lock = mUploadRing->lock();
+	executeResourceCommands(prepareResourceUpdate(res, subresource, buffer, size, copy));
+}
+
+Renderer::RenderTask Renderer::prepareResourceUpdate(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT64, UINT)>& copy)
 {
-	auto src = Resource::create();
-	addUploadingResource(src);
 	const auto& desc = res->getDesc();
+	UINT64 requiredSize = std::min(size, desc.Width);
+	UINT64 rowSize = requiredSize;
+	UINT numRows = 1;
+	UINT64 alignment = 16;
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
+	footprint.Footprint.RowPitch = (UINT)requiredSize;
 
-	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE2D)
 	{
-		src->init(desc, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ, {});
-		src->blit(buffer, std::min(size, desc.Width));
+		mDevice->GetCopyableFootprints(&desc, subresource, 1, 0, &footprint, &numRows, &rowSize, &requiredSize);
+		alignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
 	}
-	else if (desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE2D)
+	else if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+	{
+		WARN("unsupported resource.");
+		return [](CommandList*) {};
+	}
+
+	auto upload = mUploadRing->alloc(requiredSize, alignment);
+	// the copies see the ring through a resource of their own, e.g. for the views of the srgb conversion
+	auto src = Resource::Ptr();
+	if (upload.buffer)
+		src = Resource::create(ComPtr<ID3D12Resource>(upload.buffer->get()), D3D12_RESOURCE_STATE_GENERIC_READ);
+	else
 	{
-		UINT64 requiredSize = 0;
-		UINT64 rowSize = 0;
-		UINT numRows = 0;
-		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
-		Renderer::getSingleton()->getDevice()->GetCopyableFootprints(&desc, subresource, 1, 0, &footprint, &numRows, &rowSize, &requiredSize);
-		
 		D3D12_RESOURCE_DESC resdesc = {};
 		resdesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		resdesc.Alignment = 0;
@@ -239,40 +277,47 @@ void Renderer::updateResource(Resource::Ref res, UINT subresource, const void* b
 		resdesc.SampleDesc.Quality = 0;
 		resdesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
 		resdesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-		
-		src->init(resdesc, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ, {});
 
+		src = Resource::create();
+		src->init(resdesc, D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_STATE_GENERIC_READ, {});
+		upload.data = src->map(0);
+	}
+	addUploadingResource(src);
 
-		char* data = src->map(0);
-		for (size_t i = 0; i < numRows; ++i)
-		{
-			memcpy(data, buffer, (size_t)rowSize);
-			data += footprint.Footprint.RowPitch;
-			buffer = (const char*)buffer + rowSize;
-		}
-		src->unmap(0);
+	char* data = upload.data;
+	for (size_t i = 0; i < numRows; ++i)
+	{
+		memcpy(data, buffer, (size_t)rowSize);
+		data += footprint.Footprint.RowPitch;
+		buffer = (const char*)buffer + rowSize;
 	}
-	else
-		WARN("unsupported resource.");
+	if (!upload.buffer)
+		src->unmap(0);
 
-	executeResourceCommands([=](CommandList * cmdlist){
+	return [=, offset = upload.offset](CommandList * cmdlist){
 		cmdlist->transitionBarrier(res, D3D12_RESOURCE_STATE_COPY_DEST, -1, true);
-		copy(cmdlist, src, subresource);
-	});
+		copy(cmdlist, src, offset, subresource);
+	};
 }
 
 void Renderer::updateBuffer(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size)
 {
-	updateResource(res, subresource, buffer, size, [dst = res, size](CommandList * cmdlist, Resource::Ref src, UINT sub){
-		cmdlist->copyBuffer(dst, sub, src, 0, size);
+	updateResource(res, subresource, buffer, size, [dst = res, size](CommandList * cmdlist, Resource::Ref src, UINT64 offset, UINT sub){
+		cmdlist->copyBuffer(dst, sub, src, (UINT)offset, size);
 	});
 }
 
 void Renderer::updateTexture(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, bool srgb)
+{
+	auto lock = mUploadRing->lock();
+	executeResourceCommands(prepareTextureUpdate(res, subresource, buffer, size, srgb));
+}
+
+Renderer::RenderTask Renderer::prepareTextureUpdate(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, bool srgb)
 {
 	Resource::Ptr mid = Resource::create();
 	addUploadingResource(mid);
-	updateResource(res, subresource, buffer, size, [dst = res, srgb , this, pso = mSRGBConv  , mid](auto cmdlist, auto src, auto sub) {
+	return prepareResourceUpdate(res, subresource, buffer, size, [dst = res, srgb , this, pso = mSRGBConv  , mid](auto cmdlist, auto src, auto offset, auto sub) {
 		if (srgb)
 		{
 			auto bufferdesc = src->getDesc();
@@ -284,11 +329,12 @@ void Renderer::updateTexture(Resource::Ref res, UINT subresource, const void* bu
 			D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
 			Renderer::getSingleton()->getDevice()->GetCopyableFootprints(&texdesc, sub, 1, 0, &footprint, &numRows, &rowSize, &requiredSize);
 			
+			bufferdesc.Width = requiredSize;
 			bufferdesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
 			mid->init(bufferdesc, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, {});
 
 			UINT stride = (UINT)D3DHelper::sizeof_DXGI_FORMAT(texdesc.Format);
-			src->createBuffer(texdesc.Format,0, (UINT)requiredSize / stride,0,0);
+			src->createBuffer(texdesc.Format, offset / stride, (UINT)requiredSize / stride,0,0);
 			
 			{
 				D3D12_UNORDERED_ACCESS_VIEW_DESC uavdesc = {};
@@ -315,7 +361,7 @@ void Renderer::updateTexture(Resource::Ref res, UINT subresource, const void* bu
 			cmdlist->copyTexture(dst, sub, {0,0,0}, mid,0,nullptr);
 		}
 		else
-			cmdlist->copyTexture(dst, sub, { 0,0,0 }, src, 0, nullptr);
+			cmdlist->copyTexture(dst, sub, { 0,0,0 }, src, 0, nullptr, offset);
 	});
 }
 
@@ -330,7 +376,17 @@ void Renderer::executeResourceCommands(RenderTask&& dofunc)
 
 Renderer::Shader::Ptr Renderer::compileShaderFromFile(const std::string & absfilepath, const std::string & entry, const std::string & target, const std::vector<D3D_SHADER_MACRO>& macros)
 {
-	auto path = findFile(absfilepath);
+	return compileShader(absfilepath, readShaderFile(absfilepath), entry, target, macros);
+}
+
+void Renderer::compileShaderFromFileAsync(const std::string& path, const std::string& entry, const std::string& target, UniqueFunction<void(Shader::Ptr)>&& callback, const std::vector<D3D_SHADER_MACRO>& macros)
+{
+	compileShaderAsync(path, readShaderFile(path), entry, target, std::move(callback), macros);
+}
+
+std::string Renderer::readShaderFile(const std::string& filename)
+{
+	auto path = findFile(filename);
 	std::fstream file(path, std::ios::in | std::ios::binary);
 	if (!file)
 		WARN( "fail to open shader file");
@@ -342,7 +398,7 @@ Renderer::Shader::Ptr Renderer::compileShaderFromFile(const std::string & absfil
 	context.resize(size);
 	file.read(&context[0], size);
 	file.close();
-	return compileShader(absfilepath,context,entry,target,  macros);
+	return context;
 }
 
 Renderer::Shader::Ptr Renderer::compileShader(const std::string& name, const std::string & context, const std::string & entry, const std::string & target,const std::vector<D3D_SHADER_MACRO>& incomingMacros, const std::string& cachename)
@@ -545,6 +601,29 @@ Renderer::Shader::Ptr Renderer::compileShader(const std::string& name, const std
 	return Shader::Ptr(new Shader(result, type, hash));
 }
 
+void Renderer::compileShaderAsync(const std::string& name, const std::string& context, const std::string& entry, const std::string& target, UniqueFunction<void(Shader::Ptr)>&& callback, const std::vector<D3D_SHADER_MACRO>& macros)
+{
+	// macros only point to the caller's strings, keep copies until the task runs
+	std::vector<std::pair<std::string, std::string>> defines;
+	for (auto& m : macros)
+	{
+		if (m.Name)
+			defines.push_back({ m.Name, m.Definition ? m.Definition : "" });
+	}
+
+	mBackgroundTasks->addTask([this, name, context, entry, target, defines = std::move(defines), callback = std::move(callback)]() {
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (auto& d : defines)
+			macros.push_back({ d.first.c_str(), d.second.c_str() });
+		callback(compileShader(name, context, entry, target, macros));
+	}, false);
+}
+
+TaskExecutor& Renderer::getBackgroundExecutor()
+{
+	return *mBackgroundTasks;
+}
+
 
 Renderer::Fence::Ptr Renderer::createFence()
 {
@@ -586,7 +665,7 @@ Renderer::Resource::Ref Renderer::createTexture2DBase(UINT width, UINT height, U
 	resdesc.Flags = flags;
 
 	auto tex = Resource::create();
-	tex->init(resdesc, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_COMMON, cv);
+	tex->init(resdesc, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_STATE_COMMON, cv, true);
 
 	addResource(tex);
 
@@ -608,36 +687,133 @@ Renderer::Resource::Ref Renderer::createTextureCubeArray(UINT size, DXGI_FORMAT
 }
 
 Renderer::Resource::Ref Renderer::createTextureFromFile(const std::string& filename, bool srgb)
+{
+	// decoded in the background lane like the async loads, only the caller waits for it
+	auto texture = createTextureFromFileAsync(filename, srgb);
+	if (!texture->isReady())
+	{
+		// takes the decode over if no worker started it yet, other background work is left alone
+		if (texture->mLoader)
+			texture->mLoader->wait(TaskExecutor::WM_BLOCK);
+		processStreamingTextures(true);
+	}
+	return texture->get();
+}
+
+Renderer::StreamedTexture::Ptr Renderer::createTextureFromFileAsync(const std::string& filename, bool srgb, Resource::Ref placeholder)
 {
 	auto ret = mTextureMap.find(filename);
 	if (ret != mTextureMap.end())
 		return ret->second;
 
-	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
-
-	void* data = 0;
-	int width, height, nrComponents;
+	auto texture = StreamedTexture::create();
+	texture->mName = filename;
+	texture->mSRGB = srgb;
+	texture->mPlaceholder = placeholder ? placeholder : mDefaultPlaceholder;
+	mTextureMap[filename] = texture;
+	mDecodingTextures.push_back(texture);
+
+	texture->mLoader = TaskExecutor::Ptr(new TaskExecutor(Dispatcher::getSharedContext(), DP_BACKGROUND));
+	texture->mLoader->addTask([texture = texture.get(), fn = findFile(filename)]() {
+		int width = 0, height = 0, nrComponents = 0;
+		if (stbi_is_hdr(fn.c_str()))
+		{
+			texture->mFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			texture->mData = stbi_loadf(fn.c_str(), &width, &height, &nrComponents, 4);
+		}
+		else
+			texture->mData = stbi_load(fn.c_str(), &width, &height, &nrComponents, 4);
+		texture->mWidth = width;
+		texture->mHeight = height;
+		texture->mDecoded.store(true, std::memory_order_release);
+	}, false);
+	return texture;
+}
 
-	std::string fn = (findFile((filename)));
-	if (fn.empty())
-		WARN("cannot find texture");
-	if (stbi_is_hdr(fn.c_str()))
+void Renderer::processStreamingTextures(bool wait)
+{
+	// held until the execute below, the uploads of the textures are allocated one by one before it
+	auto lock = mUploadRing->lock();
+	std::vector<RenderTask> tasks;
+	std::vector<StreamedTexture::Ptr> textures;
+	for (auto i = mDecodingTextures.begin(); i != mDecodingTextures.end();)
 	{
-		format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		data = stbi_loadf(fn.c_str(), &width, &height, &nrComponents, 4);
+		auto texture = *i;
+		if (!texture->mDecoded.load(std::memory_order_acquire))
+		{
+			++i;
+			continue;
+		}
+		// the task is past the decode, it only has to leave the loader before it goes
+		texture->mLoader->wait(TaskExecutor::WM_BLOCK);
+		texture->mLoader.reset();
+		if (!texture->mData)
+		{
+			LOG("cannot load texture {}", texture->mName);
+			texture->mTexture = texture->mPlaceholder;
+			texture->mReady = true;
+			i = mDecodingTextures.erase(i);
+			continue;
+		}
+
+		// the staging copy of the top mip, with its row pitch and placement
+		D3D12_RESOURCE_DESC desc = {};
+		desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+		desc.Width = texture->mWidth;
+		desc.Height = texture->mHeight;
+		desc.DepthOrArraySize = 1;
+		desc.MipLevels = 1;
+		desc.Format = texture->mFormat;
+		desc.SampleDesc.Count = 1;
+		UINT64 requiredSize = 0;
+		mDevice->GetCopyableFootprints(&desc, 0, 1, 0, nullptr, nullptr, nullptr, &requiredSize);
+		// what does not fit into the ring goes with a later frame, unless there is nothing to wait for
+		if (!wait && !tasks.empty() && !mUploadRing->fits(requiredSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT))
+			break;
+
+		auto size = (UINT64)texture->mWidth * texture->mHeight * D3DHelper::sizeof_DXGI_FORMAT(texture->mFormat);
+
+		auto tex = createTexture2DBase(texture->mWidth, texture->mHeight, 1, texture->mFormat, -1, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_NONE);
+		tex->createTexture2D();
+		tex->setName(texture->mName);
+		tasks.push_back(prepareTextureUpdate(tex, 0, texture->mData, size, texture->mSRGB));
+		if (tex->getDesc().MipLevels > 1)
+			tasks.push_back(prepareMips(tex));
+		stbi_image_free(texture->mData);
+		texture->mData = nullptr;
+		texture->mTexture = tex;
+
+		textures.push_back(texture);
+		i = mDecodingTextures.erase(i);
 	}
-	else
+
+	if (!tasks.empty())
 	{
-		data = stbi_load(fn.c_str(), &width, &height, &nrComponents, 4);
+		// one command list for every texture of the frame
+		executeResourceCommands([tasks = std::move(tasks)](CommandList* cmdlist) {
+			for (auto& task : tasks)
+				task(cmdlist);
+		});
+		auto fence = createFence();
+		fence->signal(mResourceQueue->get());
+		mStreamingBatches.push_back({std::move(textures), fence});
 	}
-	ASSERT(data != nullptr,"cannot create texture");
-	
-	auto tex = createTexture2D(width, height, format,  -1,data, srgb);
-	stbi_image_free(data);
+	// the waits below are for the gpu, other uploads go on meanwhile
+	lock.unlock();
 
-	mTextureMap[filename] = tex;
-	tex->setName(filename);
-	return tex;
+	for (auto i = mStreamingBatches.begin(); i != mStreamingBatches.end();)
+	{
+		if (wait)
+			i->fence->wait();
+		else if (!i->fence->completed())
+		{
+			++i;
+			continue;
+		}
+		for (auto& texture : i->textures)
+			texture->mReady = true;
+		i = mStreamingBatches.erase(i);
+	}
 }
 
 Renderer::Resource::Ref Renderer::createTexture3D(UINT width, UINT height, UINT depth, DXGI_FORMAT format, UINT miplevels, D3D12_RESOURCE_FLAGS flags, D3D12_HEAP_TYPE type)
@@ -663,7 +839,7 @@ Renderer::Resource::Ref Renderer::createTexture3D(UINT width, UINT height, UINT
 	resdesc.Flags = flags;
 
 	auto tex = Resource::create();
-	tex->init(resdesc, type, D3D12_RESOURCE_STATE_COMMON, {});
+	tex->init(resdesc, type, D3D12_RESOURCE_STATE_COMMON, {}, true);
 
 	if ((flags & D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE) == 0)
 		tex->createShaderResource();
@@ -711,7 +887,7 @@ Renderer::Resource::Ref Renderer::createBufferBase(size_t size, bool isShaderRes
 
 	auto b = new Buffer();
 	auto res = Resource::Ptr(b);
-	res->init(resdesc, type, D3D12_RESOURCE_STATE_COMMON, {});
+	res->init(resdesc, type, D3D12_RESOURCE_STATE_COMMON, {}, true);
 	addResource(res);
 
 	return Resource::Ref(res);
@@ -801,11 +977,15 @@ Renderer::Profile::Ref Renderer::createProfile()
 
 void Renderer::generateMips(Resource::Ref texture)
 {
-	auto desc = texture->getDesc();
-
-	if (desc.MipLevels == 1)
+	if (texture->getDesc().MipLevels == 1)
 		return;
 
+	executeResourceCommands(prepareMips(texture));
+}
+
+Renderer::RenderTask Renderer::prepareMips(Resource::Ref texture)
+{
+	auto desc = texture->getDesc();
 	Resource::Ref dst = createTexture2DBase(
 		(UINT)desc.Width,
 		desc.Height,
@@ -816,8 +996,10 @@ void Renderer::generateMips(Resource::Ref texture)
 		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS
 	);
 	dst->createShaderResource();
+	// released after the frames that may use it, the task is executed in this one
+	destroyResource(dst);
 
-	executeResourceCommands([=](auto cmdlist){
+	return [=](auto cmdlist){
 		cmdlist->transitionBarrier(texture, D3D12_RESOURCE_STATE_COPY_SOURCE, 0);
 		cmdlist->transitionBarrier(dst, D3D12_RESOURCE_STATE_COPY_DEST, 0, true);
 		cmdlist->copyTexture(dst, 0, { 0,0,0 }, texture, 0, nullptr);
@@ -885,11 +1067,7 @@ void Renderer::generateMips(Resource::Ref texture)
 
 		cmdlist->transitionBarrier(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, -1, true);
 
-	});
-
-
-	destroyResource(dst);
-
+	};
 }
 
 void Renderer::registerRenderEvent(RenderEvent e, std::function<void(RenderEvent)>&& f)
@@ -908,6 +1086,14 @@ void Renderer::uninitialize()
 {
 	Dispatcher::stop(Dispatcher::getSharedContext());
 
+	mBackgroundTasks->wait();
+	// decoded pixels of textures that never got uploaded
+	for (auto& texture : mDecodingTextures)
+	{
+		texture->mLoader->wait();
+		stbi_image_free(texture->mData);
+	}
+	mDecodingTextures.clear();
 	mResourceQueue->flush();
 	mComputeQueue->flush();
 	mRenderQueue->flush();
@@ -919,6 +1105,7 @@ void Renderer::uninitialize()
 	mComputeQueue.reset();
 	mResourceQueue.reset();
 	mTimerQueue.reset();
+	mBackgroundTasks.reset();
 
 	//clear resources
 	mBackbuffers.fill({});
@@ -928,6 +1115,7 @@ void Renderer::uninitialize()
 		for (auto& r : v)
 			delete r;
 	}
+	mHeapManager.reset();
 	mPipelineStates.clear();
 	mDescriptorHeaps.fill({});
 	mTimeStampQueryHeap.Reset();
@@ -1000,16 +1188,22 @@ void Renderer::initDevice()
 		CHECK(infoQueue->PushStorageFilter(&filter));
 	}
 #endif
+
+	mHeapManager = HeapManager::create();
 }
 
 void Renderer::initCommands()
 {
-	mRenderQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT);
-	mComputeQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_COMPUTE);
-	mResourceQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT);
-	mTimerQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT,1);
+	// render graph passes go to the render and compute queues, the frame waits for them
+	mRenderQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT, NUM_COMMANDLISTS, DP_CRITICAL);
+	mComputeQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_COMPUTE, NUM_COMMANDLISTS, DP_CRITICAL);
+	// uploads and mip generation, e.g. from createTextureFromFile
+	mResourceQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT, NUM_COMMANDLISTS, DP_NORMAL);
+	mTimerQueue = CommandQueue::create(D3D12_COMMAND_LIST_TYPE_DIRECT, 1, DP_CRITICAL);
+	mBackgroundTasks = TaskExecutor::Ptr(new TaskExecutor(Dispatcher::getSharedContext(), DP_BACKGROUND));
 
 	mCurrentFrame = 0;
+	mFrameFence = createFence();
 }
 
 void Renderer::initDescriptorHeap()
@@ -1043,12 +1237,27 @@ void Renderer::initProfile()
 void Renderer::initResources()
 {
 	mConstantBufferAllocator = ConstantBufferAllocator::create();
+	mUploadRing = UploadRing::create();
 
+	// the compute shaders of the resource updates compile side by side in the background lane
+	std::array<Shader::Ptr, 4> genMips;
 	for (int i = 0; i < 4; ++i)
 	{
 		std::stringstream ss;
 		ss << i;
-		auto shader = compileShaderFromFile("shaders/gen_mips.hlsl", "main", SM_CS,{{"NON_OF_POWER", ss.str().c_str()},{NULL,NULL}});
+		compileShaderFromFileAsync("shaders/gen_mips.hlsl", "main", SM_CS, [&genMips, i](Shader::Ptr shader) {
+			genMips[i] = shader;
+		}, {{"NON_OF_POWER", ss.str().c_str()},{NULL,NULL}});
+	}
+	Shader::Ptr srgbConv;
+	compileShaderFromFileAsync("shaders/srgb_conv.hlsl", "main", SM_CS, [&srgbConv](Shader::Ptr shader) {
+		srgbConv = shader;
+	});
+	mBackgroundTasks->wait(TaskExecutor::WM_BLOCK);
+
+	for (int i = 0; i < 4; ++i)
+	{
+		auto shader = genMips[i];
 		shader->enable32BitsConstants(true);
 		shader->registerStaticSampler({
 			D3D12_FILTER_MIN_MAG_MIP_LINEAR,
@@ -1066,10 +1275,13 @@ void Renderer::initResources()
 		mGenMipsPSO[i] = std::make_shared<PipelineStateInstance>(shader);
 	}
 
+	srgbConv->enable32BitsConstants(true);
+	mSRGBConv = std::make_shared<PipelineStateInstance>(srgbConv);
+
 	{
-		auto shader = compileShaderFromFile("shaders/srgb_conv.hlsl", "main", SM_CS );
-		shader->enable32BitsConstants(true);
-		mSRGBConv = std::make_shared<PipelineStateInstance>(shader);
+		UINT8 white[] = { 255, 255, 255, 255 };
+		mDefaultPlaceholder = createTexture2D(1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, 1, white, false);
+		mDefaultPlaceholder->setName("texture placeholder");
 	}
 }
 
@@ -1102,6 +1314,14 @@ void Renderer::collectDebugInfo()
 			debugInfo.videoMemory += desc.Width * desc.Height * desc.DepthOrArraySize * D3DHelper::sizeof_DXGI_FORMAT(desc.Format);
 	}
 
+	auto arena = FrameArena::Singleton.getStats();
+	debugInfo.arenaAllocations = arena.arenaAllocations;
+	debugInfo.heapAllocations = arena.heapAllocations;
+	auto upload = mUploadRing->getStats();
+	debugInfo.uploadedBytes = upload.uploadedBytes + upload.dedicatedBytes;
+	debugInfo.uploadOverflows = upload.overflows;
+	debugInfo.threadLayout = ThreadTopology::Singleton.getDescription();
+
 	debugInfoCache = debugInfo;
 }
 
@@ -1133,8 +1353,10 @@ void Renderer::processTasks()
 {
 	PROFILE("process tasks", {});
 
+	// async compute passes of the render graph wait for the render queue and the other way around
+	CommandQueue::execute({ mComputeQueue, mRenderQueue });
+	mComputeQueue->signal();
 	mRenderQueue->wait(mComputeQueue);
-	mRenderQueue->execute();
 }
 
 
@@ -1247,6 +1469,7 @@ void Renderer::processRecycle()
 	for (auto& r: mRecycleResources[mCurrentFrame])
 		delete r;
 	mRecycleResources[mCurrentFrame].clear();
+	mHeapManager->trim();
 }
 
 void Renderer::addUploadingResource(Resource::Ptr res)
@@ -1258,7 +1481,12 @@ void Renderer::addUploadingResource(Resource::Ptr res)
 
 void Renderer::processUploadingResource()
 {
-	mResourceQueue->execute();
+	{
+		// an update of another thread cannot allocate between the execute and the end of the segment
+		auto lock = mUploadRing->lock();
+		mResourceQueue->execute();
+		mUploadRing->close();
+	}
 	auto i = mUploadingResources.begin();
 	auto endi = mUploadingResources.end();
 	for (; i != endi;)
@@ -1478,6 +1706,8 @@ Renderer::Resource::Resource()
 Renderer::Resource::~Resource()
 {
 	releaseAllHandle();
+	mResource.Reset();
+	HeapManager::free(mPlacement);
 }
 
 void Renderer::Resource::init(UINT64 size, D3D12_HEAP_TYPE heaptype, DXGI_FORMAT format, ClearValue cv)
@@ -1498,7 +1728,7 @@ void Renderer::Resource::init(UINT64 size, D3D12_HEAP_TYPE heaptype, DXGI_FORMAT
 	init(resdesc, heaptype, D3D12_RESOURCE_STATE_COMMON,cv);
 }
 
-void Renderer::Resource::init(const D3D12_RESOURCE_DESC& resdesc, D3D12_HEAP_TYPE ht, D3D12_RESOURCE_STATES state, ClearValue clear_value)
+void Renderer::Resource::init(const D3D12_RESOURCE_DESC& resdesc, D3D12_HEAP_TYPE ht, D3D12_RESOURCE_STATES state, ClearValue clear_value, bool placed)
 {
 	if (ht == D3D12_HEAP_TYPE_READBACK)
 	{
@@ -1543,9 +1773,14 @@ void Renderer::Resource::init(const D3D12_RESOURCE_DESC& resdesc, D3D12_HEAP_TYP
 		pcv = &cv;
 	}
 	
-	CHECK(device->CreateCommittedResource(&heapprop, D3D12_HEAP_FLAG_NONE, &resdesc, state, pcv, IID_PPV_ARGS(&mResource)));
-
 	mDesc = resdesc;
+	if (placed)
+		mPlacement = Renderer::getSingleton()->getHeapManager()->alloc(mDesc, ht);
+	if (mPlacement.heap)
+		CHECK(device->CreatePlacedResource(mPlacement.heap->heap.Get(), mPlacement.offset, &mDesc, state, pcv, IID_PPV_ARGS(&mResource)));
+	else
+		CHECK(device->CreateCommittedResource(&heapprop, D3D12_HEAP_FLAG_NONE, &mDesc, state, pcv, IID_PPV_ARGS(&mResource)));
+
 	mState.resize(mDesc.MipLevels, state);
 }
 
@@ -1580,6 +1815,17 @@ const D3D12_RESOURCE_STATES & Renderer::Resource::getState(UINT sub) const
 	return mState[sub];
 }
 
+void Renderer::Resource::setState(const D3D12_RESOURCE_STATES& s, UINT sub)
+{
+	if (sub != D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+	{
+		mState[sub] = s;
+		return;
+	}
+	for (auto& state : mState)
+		state = s;
+}
+
 void Renderer::Resource::setName(const std::string& name)
 {
 	std::stringstream ss;
@@ -1758,6 +2004,11 @@ bool Renderer::Fence::completed()
 	return  value >= mFenceValue;
 }
 
+UINT64 Renderer::Fence::getCompletedValue()
+{
+	return mFence->GetCompletedValue();
+}
+
 
 Renderer::CommandList::CommandList(ID3D12CommandQueue* q, D3D12_COMMAND_LIST_TYPE type):
 	mQueue(q)
@@ -1798,7 +2049,33 @@ void Renderer::CommandList::addResourceTransition(const Resource::Ref& res, D3D1
 {
 	
 	//Common::Assert(mResourceTransitions.find(res->get()) == mResourceTransitions.end(), "unexpected.");
-	mTransitionBarrier[res->get()] = {res, state, subres};
+	auto all = std::make_pair(res->get(), (UINT)D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+	if (subres == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+	{
+		// replaces whatever is pending for single subresources
+		mTransitionBarrier.erase(mTransitionBarrier.lower_bound({ res->get(), 0 }), mTransitionBarrier.lower_bound(all));
+	}
+	else if (mTransitionBarrier.count(all))
+	{
+		// the whole resource has to reach its state first
+		flushResourceBarrier();
+	}
+	mTransitionBarrier[{res->get(), subres}] = {res, state, subres};
+}
+
+void Renderer::CommandList::transition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mExplicitBarrier.push_back({res, before, after, D3D12_RESOURCE_BARRIER_FLAG_NONE, subresource});
+}
+
+void Renderer::CommandList::beginTransition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mExplicitBarrier.push_back({res, before, after, D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY, subresource});
+}
+
+void Renderer::CommandList::endTransition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource)
+{
+	mExplicitBarrier.push_back({res, before, after, D3D12_RESOURCE_BARRIER_FLAG_END_ONLY, subresource});
 }
 
 void Renderer::CommandList::flushResourceBarrier()
@@ -1875,11 +2152,24 @@ void Renderer::CommandList::flushResourceBarrier()
 		barriers.emplace_back(b);
 	}
 
+	for (auto& t : mExplicitBarrier)
+	{
+		D3D12_RESOURCE_BARRIER b = {};
+		b.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+		b.Flags = t.flags;
+		b.Transition.pResource = t.res->get();
+		b.Transition.StateBefore = t.before;
+		b.Transition.StateAfter = t.after;
+		b.Transition.Subresource = t.subresource;
+		barriers.emplace_back(b);
+	}
+
 	if (!barriers.empty())
 		mCmdList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
 	mTransitionBarrier.clear();
 	mUAVBarrier.clear();
+	mExplicitBarrier.clear();
 }
 
 void Renderer::CommandList::copyBuffer(Resource::Ref dst, UINT dstStart, Resource::Ref src, UINT srcStart, UINT64 size)
@@ -1888,7 +2178,7 @@ void Renderer::CommandList::copyBuffer(Resource::Ref dst, UINT dstStart, Resourc
 	mCmdList->CopyBufferRegion(dst->get(), dstStart, src->get(), srcStart, size);
 }
 
-void Renderer::CommandList::copyTexture(Resource::Ref dst, UINT dstSub, const std::array<UINT, 3>& dstStart, Resource::Ref src, UINT srcSub, const D3D12_BOX* srcBox)
+void Renderer::CommandList::copyTexture(Resource::Ref dst, UINT dstSub, const std::array<UINT, 3>& dstStart, Resource::Ref src, UINT srcSub, const D3D12_BOX* srcBox, UINT64 srcOffset)
 {
 	
 	bool dstIsBuffer = dst->getDesc().Dimension == D3D12_RESOURCE_DIMENSION_BUFFER;
@@ -1901,7 +2191,7 @@ void Renderer::CommandList::copyTexture(Resource::Ref dst, UINT dstSub, const st
 	UINT numRow = 0;
 	UINT64 rowSize = 0;
 	UINT64 totalSize = 0;
-	Renderer::getSingleton()->getDevice()->GetCopyableFootprints(&dstDesc,dstSub,1,0, &srclocal.PlacedFootprint,&numRow,&rowSize,&totalSize);
+	Renderer::getSingleton()->getDevice()->GetCopyableFootprints(&dstDesc,dstSub,1,srcOffset, &srclocal.PlacedFootprint,&numRow,&rowSize,&totalSize);
 
 	
 	mCmdList->CopyTextureRegion(&dstlocal, dstStart[0], dstStart[1], dstStart[2],&srclocal,(const D3D12_BOX*)srcBox);
@@ -1913,16 +2203,23 @@ void Renderer::CommandList::copyResource(const Resource::Ref& dst, const Resourc
 	mCmdList->CopyResource(dst->get(), src->get());
 }
 
-void Renderer::CommandList::discardResource(const Resource::Ref & rt)
+void Renderer::CommandList::discardResource(const Resource::Ref & rt, UINT first, UINT count)
 {
-	
-	mCmdList->DiscardResource(rt->get(),nullptr);
+	if (first == 0 && count == -1)
+	{
+		mCmdList->DiscardResource(rt->get(),nullptr);
+		return;
+	}
+	D3D12_DISCARD_REGION region = {};
+	region.FirstSubresource = first;
+	region.NumSubresources = std::min(count, (UINT)rt->mState.size() - first);
+	mCmdList->DiscardResource(rt->get(), &region);
 }
 
-void Renderer::CommandList::clearRenderTarget(const Resource::Ref & rt, const Color & color)
+void Renderer::CommandList::clearRenderTarget(const Resource::Ref & rt, const Color & color, UINT view)
 {
 	
-	mCmdList->ClearRenderTargetView(rt->getRenderTarget(), color.data(),0, nullptr);
+	mCmdList->ClearRenderTargetView(rt->getRenderTarget(view), color.data(),0, nullptr);
 }
 
 void Renderer::CommandList::clearDepth(const Resource::Ref& rt, float depth)
@@ -2978,6 +3275,195 @@ void Renderer::Profile::end(Renderer::CommandList * cl)
 }
 
 
+Renderer::HeapManager::Placement Renderer::HeapManager::alloc(D3D12_RESOURCE_DESC& desc, D3D12_HEAP_TYPE type)
+{
+	auto device = Renderer::getSingleton()->getDevice();
+	auto category = desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER ? HC_BUFFER : HC_TEXTURE;
+	std::lock_guard<std::mutex> lock(mMutex);
+	if ((category == HC_TEXTURE && type != D3D12_HEAP_TYPE_DEFAULT) ||
+		(desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)))
+	{
+		mCommitted++;
+		return {};
+	}
+
+	// small textures may take 4kb instead of 64kb, the device tells if the texture qualifies
+	D3D12_RESOURCE_ALLOCATION_INFO info = {};
+	if (category == HC_TEXTURE)
+	{
+		desc.Alignment = D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT;
+		info = device->GetResourceAllocationInfo(0, 1, &desc);
+		if (info.Alignment != D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT)
+			desc.Alignment = 0;
+	}
+	if (desc.Alignment == 0)
+		info = device->GetResourceAllocationInfo(0, 1, &desc);
+
+	// large resources gain nothing from sharing a heap
+	if (info.SizeInBytes > HEAP_SIZE / 4)
+	{
+		desc.Alignment = 0;
+		mCommitted++;
+		return {};
+	}
+
+	auto& heaps = mHeaps[{type, category}];
+	for (auto& h : heaps)
+	{
+		std::lock_guard<std::mutex> lock(h->mutex);
+		auto offset = h->allocator.alloc(info.SizeInBytes, info.Alignment);
+		if (offset != HeapAllocator::INVALID_OFFSET)
+			return {h, offset};
+	}
+
+	auto h = std::make_shared<Heap>();
+	D3D12_HEAP_DESC heapdesc = {};
+	heapdesc.SizeInBytes = HEAP_SIZE;
+	heapdesc.Properties.Type = type;
+	heapdesc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	heapdesc.Flags = category == HC_BUFFER ? D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS : D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES;
+	CHECK(device->CreateHeap(&heapdesc, IID_PPV_ARGS(&h->heap)));
+	heaps.push_back(h);
+
+	std::lock_guard<std::mutex> hl(h->mutex);
+	return {h, h->allocator.alloc(info.SizeInBytes, info.Alignment)};
+}
+
+void Renderer::HeapManager::free(Placement& placement)
+{
+	if (!placement.heap)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(placement.heap->mutex);
+		placement.heap->allocator.free(placement.offset);
+	}
+	placement.heap.reset();
+}
+
+void Renderer::HeapManager::trim()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto& [key, heaps] : mHeaps)
+	{
+		bool keep = true;
+		heaps.erase(std::remove_if(heaps.begin(), heaps.end(), [&](auto& h) {
+			std::lock_guard<std::mutex> lock(h->mutex);
+			if (!h->allocator.empty())
+				return false;
+			// one empty heap stays for the next allocations
+			auto remove = !keep;
+			keep = false;
+			return remove;
+		}), heaps.end());
+	}
+}
+
+Renderer::HeapManager::Stats Renderer::HeapManager::getStats()
+{
+	Stats stats;
+	std::lock_guard<std::mutex> lock(mMutex);
+	stats.committed = mCommitted;
+	for (auto& [key, heaps] : mHeaps)
+	{
+		for (auto& h : heaps)
+		{
+			std::lock_guard<std::mutex> lock(h->mutex);
+			auto s = h->allocator.getStats();
+			stats.numHeaps++;
+			stats.heapBytes += s.size;
+			stats.usedBytes += s.usedBytes;
+			stats.placed += s.allocations;
+		}
+	}
+	return stats;
+}
+
+Renderer::UploadRing::UploadRing()
+{
+	mResource = Renderer::getSingleton()->createBufferBase(RING_SIZE, true, D3D12_HEAP_TYPE_UPLOAD);
+	mResource->setName("upload ring");
+	mBegin = mResource->map(0);
+}
+
+Renderer::UploadRing::Allocation Renderer::UploadRing::alloc(UINT64 size, UINT64 alignment)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	auto head = place(size, alignment);
+	if (size > RING_SIZE / 4 || head + size - getOpenBegin() > RING_SIZE)
+	{
+		// even an idle gpu would not leave room next to the copies of the open segment
+		mStats.dedicatedBytes += size;
+		return {};
+	}
+
+	retire();
+	if (head + size - mTail > RING_SIZE)
+	{
+		// waiting here would stall every other upload behind the lock, and the caller may hold it
+		mStats.overflows++;
+		mStats.dedicatedBytes += size;
+		return {};
+	}
+
+	mHead = head + size;
+	mStats.uploadedBytes += size;
+	return {mResource, head % RING_SIZE, mBegin + head % RING_SIZE};
+}
+
+bool Renderer::UploadRing::fits(UINT64 size, UINT64 alignment)
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	retire();
+	return size <= RING_SIZE / 4 && place(size, alignment) + size - mTail <= RING_SIZE;
+}
+
+void Renderer::UploadRing::close()
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	closeSegment();
+	retire();
+}
+
+Renderer::UploadRing::Stats Renderer::UploadRing::getStats()
+{
+	std::lock_guard<std::recursive_mutex> lock(mMutex);
+	return mStats;
+}
+
+void Renderer::UploadRing::closeSegment()
+{
+	// nothing uploaded since the last segment
+	if (mHead == getOpenBegin())
+		return;
+	auto renderer = Renderer::getSingleton();
+	auto fence = renderer->createFence();
+	fence->signal(renderer->mResourceQueue->get());
+	mSegments.push_back({mHead, fence});
+}
+
+UINT64 Renderer::UploadRing::place(UINT64 size, UINT64 alignment)const
+{
+	auto head = ALIGN(mHead, alignment);
+	// an allocation does not wrap around, it starts over at the beginning of the buffer
+	if (head / RING_SIZE != (head + size - 1) / RING_SIZE)
+		head = ALIGN(head, RING_SIZE);
+	return head;
+}
+
+UINT64 Renderer::UploadRing::getOpenBegin()const
+{
+	return mSegments.empty() ? mTail : mSegments.back().end;
+}
+
+void Renderer::UploadRing::retire()
+{
+	while (!mSegments.empty() && mSegments.front().fence->completed())
+	{
+		mTail = mSegments.front().end;
+		mSegments.pop_front();
+	}
+}
+
 Renderer::ConstantBufferAllocator::ConstantBufferAllocator()
 {
 	mResource = Renderer::getSingleton()->createBufferBase(cache_size,false,D3D12_HEAP_TYPE_UPLOAD);
@@ -3086,10 +3572,9 @@ D3D12_GPU_DESCRIPTOR_HANDLE Renderer::ConstantBuffer::getHandle() const
 	return mView.gpu;
 }
 
-Renderer::CommandQueue::CommandQueue(D3D12_COMMAND_LIST_TYPE type, size_t maxsize, asio::io_context& context):
-	mTaskExecutor(context)
+Renderer::CommandQueue::CommandQueue(D3D12_COMMAND_LIST_TYPE type, size_t maxsize, DispatchPriority priority, asio::io_context& context):
+	mTaskExecutor(context, priority)
 {
-	mMaxCommandListSize = maxsize;
 	auto renderer = Renderer::getSingleton();
 	{
 		D3D12_COMMAND_QUEUE_DESC desc = {};
@@ -3108,25 +3593,24 @@ Renderer::CommandQueue::CommandQueue(D3D12_COMMAND_LIST_TYPE type, size_t maxsiz
 	//mCurrentFrame = 0;
 	mFence = renderer->createFence();
 
-	std::string cmdlistNames[] = {
-		"Render",
-		"Bundle",
-		"Compute",
-		"Copy",
-		"VideoDecode",
-		"VideoProcess",
-		"VideoEncode",
-	};
+	// command lists are created on first use, maxsize only sizes the free ring
+	mCommandLists = std::make_unique<CommandListRing<CommandList>>(maxsize, [queue = mQueue.Get(), type](size_t index) {
+		static const char* cmdlistNames[] = {
+			"Render",
+			"Bundle",
+			"Compute",
+			"Copy",
+			"VideoDecode",
+			"VideoProcess",
+			"VideoEncode",
+		};
 
-	for (UINT i = 0; i < mMaxCommandListSize; ++i)
-	{
-		//auto cmdlist = CommandList::create();
-		mCommandLists.emplace_back(mQueue.Get(), type);
-		auto& cmdlist = mCommandLists.back();
-		cmdlist.close();
-		mOriginCommandLists.emplace_back(cmdlist.mCmdList.Get());
-		cmdlist.mCmdList->SetName(M2U(std::format("{}{}{}",cmdlistNames[type], "_CommandList", i)).c_str());
-	}
+		auto cmdlist = new CommandList(queue, type);
+		cmdlist->close();
+		cmdlist->mCmdList->SetName(M2U(std::format("{}{}{}", cmdlistNames[type], "_CommandList", index)).c_str());
+		return cmdlist;
+	});
+	mOriginCommandLists.reserve(maxsize);
 
 	mHeap = renderer->getDescriptorHeap(DHT_CBV_SRV_UAV);
 }
@@ -3136,79 +3620,180 @@ Renderer::CommandQueue::~CommandQueue()
 	flush();
 }
 
-Renderer::CommandList& Renderer::CommandQueue::acquireComandList()
+Renderer::CommandQueue::CommandListSlot Renderer::CommandQueue::acquireComandList()
 {
-	auto index = mUsedCommandListsCount.fetch_add(1, std::memory_order::memory_order_acquire);
-	ASSERT(index < mMaxCommandListSize, "too many render tasks");
-	
-	return mCommandLists[index];
+	return mCommandLists->acquire();
 }
 
 
 void Renderer::CommandQueue::addCommand(Command&& task, bool strand)
 {
 	//std::unique_lock<std::mutex> lock(mMutex);
-	auto cmdlist = &acquireComandList();
-	auto make_task = [t = std::move(task), cmdlist , this](){
+	auto slot = acquireComandList();
+	mTaskExecutor.addCoroutineTask([](Command t, CommandListSlot slot, CommandListRing<CommandList>* ring, DescriptorHeap::Ref heap)->Future<Promise>
+	{
+		co_await std::suspend_always();
+		auto cmdlist = slot.item;
 		cmdlist->reset();
-		cmdlist->setDescriptorHeap(mHeap);
+		cmdlist->setDescriptorHeap(heap);
 		t(cmdlist);
 		cmdlist->close();
-	};
-
-	mTaskExecutor.addTask(std::move(make_task), strand);
+		ring->publish(slot);
+		co_return;
+	}, strand, std::move(task), slot, mCommandLists.get(), mHeap);
 }
 
 void Renderer::CommandQueue::addCoroutineCommand(CoroutineCommand&& task, bool strand)
 {
-	auto cmdlist = &acquireComandList();
-	Coroutine<Promise> co(task, cmdlist);
-	mTaskExecutor.addCoroutineTask([](CommandList* cmdlist, Coroutine<Promise> co, DescriptorHeap::Ref heap)->Future<Promise>
+	auto slot = acquireComandList();
+	Coroutine<Promise> co(task, slot.item);
+	mTaskExecutor.addCoroutineTask([](CommandListSlot slot, CommandListRing<CommandList>* ring, Coroutine<Promise> co, DescriptorHeap::Ref heap)->Future<Promise>
 	{
 		co_await std::suspend_always();
+		auto cmdlist = slot.item;
 		cmdlist->reset();
 		cmdlist->setDescriptorHeap(heap);
 		while (!co.done())
 		{
-			co_await std::suspend_always();
+			co_await co.yield();
 			co.resume();
 		}
 		cmdlist->close();
+		ring->publish(slot);
 		co_return;
-	}, strand,cmdlist, std::move(co), mHeap);
+	}, strand, slot, mCommandLists.get(), std::move(co), mHeap);
 }
 
 
-void Renderer::CommandQueue::execute()
+Renderer::CommandQueue::SyncPoint::Ptr Renderer::CommandQueue::addSignal()
+{
+	auto point = std::make_shared<SyncPoint>();
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMarkers.push_back({ mCommandLists->getNumAcquired(), point, true });
+	return point;
+}
+
+void Renderer::CommandQueue::addWait(const SyncPoint::Ptr& point)
 {
-	auto count = UINT(mUsedCommandListsCount.exchange(0, std::memory_order::relaxed));
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMarkers.push_back({ mCommandLists->getNumAcquired(), point, false });
+}
 
-	PROFILE("execute commandqueue", {});
+void Renderer::CommandQueue::execute()
+{
+	collect();
+	PROFILE("execute commandlist", {});
+	if (!submit())
 	{
-		PROFILE("fill commandlist", {});
+		// the fence would never be signalled, the rest goes unordered rather than not at all
+		LOG("command queue waits for a queue that is not executed with it, the wait is dropped");
+		submit(true);
+	}
+}
+
+void Renderer::CommandQueue::execute(const std::vector<CommandQueue::Ref>& queues)
+{
+	for (auto& q : queues)
+		q->collect();
 
-		//{
-		//	PROFILE("do tasks", {});
-		//	auto& cnt = Dispatcher::getSharedContext();
-		//	cnt.poll();
-		//}
+	PROFILE("execute commandlist", {});
+	std::vector<bool> done(queues.size(), false);
+	bool finished = false;
+	while (!finished)
+	{
+		finished = true;
+		bool progress = false;
+		for (size_t i = 0; i < queues.size(); ++i)
+		{
+			if (done[i])
+				continue;
+			auto& q = queues[i];
+			auto marker = q->mNextMarker;
+			done[i] = q->submit();
+			progress = progress || done[i] || marker != q->mNextMarker;
+			finished = finished && done[i];
+		}
+		if (!finished && !progress)
 		{
-			PROFILE("wait tasks", {});
-			mTaskExecutor.wait();
+			LOG("command queues wait for each other, their waits are dropped");
+			for (size_t i = 0; i < queues.size(); ++i)
+			{
+				if (!done[i])
+					queues[i]->submit(true);
+			}
+			break;
 		}
 	}
+}
+
+void Renderer::CommandQueue::collect()
+{
+	PROFILE("fill commandlist", {});
+
+	//{
+	//	PROFILE("do tasks", {});
+	//	auto& cnt = Dispatcher::getSharedContext();
+	//	cnt.poll();
+	//}
 	{
-		PROFILE("execute commandlist", {});
-		//std::unique_lock<std::mutex> lock(mMutex);
-		mQueue->ExecuteCommandLists(count, mOriginCommandLists.data());
-		mUsedCommandListsCount = 0;
+		PROFILE("wait tasks", {});
+		mTaskExecutor.wait(TaskExecutor::WM_BLOCK);
 	}
+
+	//std::unique_lock<std::mutex> lock(mMutex);
+	// tickets were taken in the order commands were added, which is the order of the graph
+	mOriginCommandLists.clear();
+	mCommandLists->consume([this](CommandList* cmdlist) {
+		mOriginCommandLists.push_back(cmdlist->mCmdList.Get());
+	});
+	mNextMarker = 0;
+	mNumSubmitted = 0;
+}
+
+bool Renderer::CommandQueue::submit(bool skipWaits)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	while (true)
+	{
+		auto end = mOriginCommandLists.size();
+		if (mNextMarker < mMarkers.size())
+			end = std::min(end, mMarkers[mNextMarker].position);
+		if (end > mNumSubmitted)
+		{
+			mQueue->ExecuteCommandLists(UINT(end - mNumSubmitted), mOriginCommandLists.data() + mNumSubmitted);
+			mNumSubmitted = end;
+		}
+
+		if (mNextMarker == mMarkers.size())
+			break;
+
+		auto& marker = mMarkers[mNextMarker];
+		if (marker.signal)
+		{
+			mFence->signal(mQueue.Get());
+			marker.point->fence = mFence;
+			marker.point->value = mFence->mFenceValue;
+		}
+		else
+		{
+			// the other queue has not got that far
+			if (marker.point->value != 0)
+				mQueue->Wait(marker.point->fence->mFence.Get(), marker.point->value);
+			else if (!skipWaits)
+				return false;
+		}
+		++mNextMarker;
+	}
+
+	mMarkers.clear();
+	mNextMarker = 0;
+	return true;
 }
 
 void Renderer::CommandQueue::flush()
 {
 	signal();
-	mTaskExecutor.getContext().poll();
+	mTaskExecutor.poll();
 	wait();
 }
 
@@ -3238,9 +3823,11 @@ void Renderer::CommandQueue::wait(CommandQueue::Ref prequeue)
 	mQueue->Wait(fence->mFence.Get(), fence->mFenceValue);
 }
 
-Renderer::CommandQueue::CommandListWrapper::CommandListWrapper( CommandQueue* queue)
+Renderer::CommandQueue::CommandListWrapper::CommandListWrapper( CommandQueue* queue):
+	queue(queue)
 {
-	cmdlist = &queue->acquireComandList();
+	slot = queue->acquireComandList();
+	cmdlist = slot.item;
 	cmdlist->reset();
 	cmdlist->setDescriptorHeap(queue->mHeap);
 }
@@ -3248,4 +3835,5 @@ Renderer::CommandQueue::CommandListWrapper::CommandListWrapper( CommandQueue* qu
 Renderer::CommandQueue::CommandListWrapper::~CommandListWrapper()
 {
 	cmdlist->close();
+	queue->mCommandLists->publish(slot);
 }
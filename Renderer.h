@@ -1,7 +1,11 @@
 #pragma once
 #include "Common.h"
 #include "TaskExecutor.h"
+#include "Thread.h"
 #include "Fence.h"
+#include "CommandListRing.h"
+#include "HeapAllocator.h"
+#include "RenderTypes.h"
 
 
 #define SM_VS	"vs_5_0"
@@ -11,7 +15,8 @@
 #define SM_PS	"ps_5_0"
 #define SM_CS	"cs_5_0"
 
-class Renderer
+// view types come from RenderTypes, which the device free code shares
+class Renderer: public RenderTypes
 {
 
 	using IDXGIFACTORY = IDXGIFactory4;
@@ -46,15 +51,6 @@ public:
 	using MemoryData = std::shared_ptr<std::vector<char>>;
 
 
-	enum ViewType
-	{
-		VT_UNKNOWN,
-
-		VT_RENDERTARGET,
-		VT_DEPTHSTENCIL,
-		VT_UNORDEREDACCESS,
-	};
-
 	enum RenderEvent
 	{
 		RE_BEFORE_RESIZE,
@@ -68,6 +64,12 @@ public:
 		size_t primitiveCount = 0;
 		size_t numResources = 0;
 		size_t videoMemory = 0;
+		size_t arenaAllocations = 0;
+		size_t heapAllocations = 0;
+		UINT64 uploadedBytes = 0;
+		size_t uploadOverflows = 0;
+		// cores and how the threads are pinned to them, see ThreadTopology
+		std::string threadLayout;
 
 		void reset()
 		{
@@ -75,6 +77,10 @@ public:
 			primitiveCount = 0;
 			numResources = 0;
 			videoMemory = 0;
+			arenaAllocations = 0;
+			heapAllocations = 0;
+			uploadedBytes = 0;
+			uploadOverflows = 0;
 		}
 
 		void operator =(const DebugInfo& di)
@@ -83,6 +89,11 @@ public:
 			primitiveCount = di.primitiveCount;
 			numResources = di.numResources;
 			videoMemory = di.videoMemory;
+			arenaAllocations = di.arenaAllocations;
+			heapAllocations = di.heapAllocations;
+			uploadedBytes = di.uploadedBytes;
+			uploadOverflows = di.uploadOverflows;
+			threadLayout = di.threadLayout;
 		}
 	};
 
@@ -226,6 +237,58 @@ public:
 
 	};
 
+	// places resources in large heaps instead of committing each of them.
+	// heaps are kept per heap type and resource category, since tier 1 hardware cannot mix buffers and textures.
+	// render targets and depth stencils stay committed, placed ones would have to be cleared or discarded before their first use
+	class HeapManager: public Interface<HeapManager>
+	{
+	public:
+		static const UINT64 HEAP_SIZE = 64 * 1024 * 1024;
+
+		struct Heap
+		{
+			ComPtr<ID3D12Heap> heap;
+			HeapAllocator allocator;
+			std::mutex mutex;
+
+			Heap(): allocator(HEAP_SIZE, D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT) {}
+		};
+
+		struct Placement
+		{
+			// keeps the heap alive as long as the resource
+			std::shared_ptr<Heap> heap;
+			UINT64 offset = 0;
+		};
+
+		struct Stats
+		{
+			size_t numHeaps = 0;
+			UINT64 heapBytes = 0;
+			UINT64 usedBytes = 0;
+			size_t placed = 0;
+			size_t committed = 0;
+		};
+
+		// no heap in the placement if the resource is better committed, may lower the alignment of desc
+		Placement alloc(D3D12_RESOURCE_DESC& desc, D3D12_HEAP_TYPE type);
+		// the gpu must be done with the resource
+		static void free(Placement& placement);
+		// releases the empty heaps but one of each kind
+		void trim();
+		Stats getStats();
+	private:
+		enum Category
+		{
+			HC_BUFFER,
+			HC_TEXTURE,
+		};
+
+		std::mutex mMutex;
+		std::map<std::pair<D3D12_HEAP_TYPE, Category>, std::vector<std::shared_ptr<Heap>>> mHeaps;
+		size_t mCommitted = 0;
+	};
+
 	class CommandList;
 	class Resource: public Interface<Resource>
 	{
@@ -247,7 +310,8 @@ public:
 		Resource(ComPtr<ID3D12Resource> res, D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COMMON);
 		virtual ~Resource();
 		void init(UINT64 size, D3D12_HEAP_TYPE ht, DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, ClearValue cv = {});
-		void init(const D3D12_RESOURCE_DESC& resdesc, D3D12_HEAP_TYPE ht, D3D12_RESOURCE_STATES ressate, ClearValue cv);
+		// placed resources go to the heaps of the renderer if they fit, the others are committed
+		void init(const D3D12_RESOURCE_DESC& resdesc, D3D12_HEAP_TYPE ht, D3D12_RESOURCE_STATES ressate, ClearValue cv, bool placed = false);
 		void init(UINT width, UINT height, D3D12_HEAP_TYPE ht, DXGI_FORMAT format, D3D12_RESOURCE_FLAGS flags, ClearValue cv);
 		virtual void blit(const void* data, UINT64 size, UINT subresource = 0);
 		char* map(UINT sub);
@@ -256,7 +320,8 @@ public:
 
 		const D3D12_RESOURCE_STATES& getState(UINT sub = 0)const;
 		// transition by cmdlist
-		//void setState(const D3D12_RESOURCE_STATES& s);
+		// or by whoever records explicit transitions and knows the state the resource ends in
+		void setState(const D3D12_RESOURCE_STATES& s, UINT sub = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
 		void setName(const std::string& name);
 		const std::string& getName()const{return mName;}
 
@@ -294,6 +359,7 @@ public:
 		std::string mName;
 		std::array<std::vector<DescriptorHandle>, HT_Num> mHandles;
 		ClearValue mClearValue;
+		HeapManager::Placement mPlacement;
 	};
 
 	class ConstantBufferAllocator:public Interface<ConstantBufferAllocator>
@@ -364,12 +430,76 @@ public:
 		void signal();
 		void signal(ID3D12CommandQueue* q);
 		bool completed();
+		UINT64 getCompletedValue();
 	private:
 		ComPtr<ID3D12Fence> mFence;
 		HANDLE mFenceEvent;
 		UINT64 mFenceValue;
 	};
 
+	// persistently mapped upload buffer for updateResource.
+	// the updates of a frame are suballocated one after another into a segment,
+	// the space of a segment comes back once the resource queue signals that it is done with the frame.
+	class UploadRing: public Interface<UploadRing>
+	{
+	public:
+		static const UINT64 RING_SIZE = 64 * 1024 * 1024;
+
+		struct Allocation
+		{
+			// no buffer if the upload is too large for the ring
+			Resource::Ref buffer;
+			UINT64 offset = 0;
+			char* data = nullptr;
+		};
+
+		struct Stats
+		{
+			UINT64 uploadedBytes = 0;
+			// uploads that did not fit and got their own resource
+			UINT64 dedicatedBytes = 0;
+			// allocations that found the gpu still using the space, counted in dedicatedBytes as well
+			size_t overflows = 0;
+		};
+
+		UploadRing();
+		// no buffer as well if the copies recorded since the last close() leave no room,
+		// or if the gpu is not done with the space yet. it never waits, the caller uploads through its own resource
+		Allocation alloc(UINT64 size, UINT64 alignment);
+		// whether alloc() finds room now
+		bool fits(UINT64 size, UINT64 alignment);
+		// ends the segment of the frame, after the resource queue executed its copies
+		void close();
+		Stats getStats();
+		// held from the allocations until the execute of their copies, and around the execute before close(),
+		// so that a segment never ends between an allocation and the submission of its copy
+		std::unique_lock<std::recursive_mutex> lock() { return std::unique_lock<std::recursive_mutex>(mMutex); }
+	private:
+		void closeSegment();
+		// gives back the space of the segments the gpu is done with
+		void retire();
+		// position of an allocation behind the head
+		UINT64 place(UINT64 size, UINT64 alignment)const;
+		// start of the segment whose copies are not submitted yet
+		UINT64 getOpenBegin()const;
+
+		struct Segment
+		{
+			// position behind the last allocation of the segment
+			UINT64 end;
+			Fence::Ptr fence;
+		};
+
+		std::recursive_mutex mMutex;
+		Resource::Ref mResource;
+		char* mBegin;
+		// positions grow forever, the offset in the buffer is the position modulo RING_SIZE
+		UINT64 mHead = 0;
+		UINT64 mTail = 0;
+		std::deque<Segment> mSegments;
+		Stats mStats;
+	};
+
 	class CommandAllocator final: public Interface<CommandAllocator>
 	{
 	friend class Renderer::CommandList;
@@ -616,12 +746,19 @@ public:
 		void transitionBarrier( Resource::Ref res, D3D12_RESOURCE_STATES state, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, bool autoflush = false);
 		void uavBarrier(Resource::Ref res, bool autoflush = false);
 		void addResourceTransition(const Resource::Ref& res, D3D12_RESOURCE_STATES state, UINT subresource);
+		// explicit transitions, they leave the state recorded in the resource alone.
+		// a split transition must not be used between begin and end
+		void transition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		void beginTransition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+		void endTransition(const Resource::Ref& res, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
 		void flushResourceBarrier();
 		void copyBuffer(Resource::Ref dst, UINT dstStart, Resource::Ref src, UINT srcStart, UINT64 size );
-		void copyTexture(Resource::Ref dst, UINT dstSub, const std::array<UINT, 3>& dstStart, Resource::Ref src, UINT srcSub, const D3D12_BOX* srcBox );
+		// srcOffset is where the footprint starts if src is a buffer
+		void copyTexture(Resource::Ref dst, UINT dstSub, const std::array<UINT, 3>& dstStart, Resource::Ref src, UINT srcSub, const D3D12_BOX* srcBox, UINT64 srcOffset = 0);
 		void copyResource(const Resource::Ref& dst, const Resource::Ref& src);
-		void discardResource(const Resource::Ref& rt);
-		void clearRenderTarget(const Resource::Ref& rt, const Color& color);
+		// count -1 for the subresources up to the last one
+		void discardResource(const Resource::Ref& rt, UINT first = 0, UINT count = -1);
+		void clearRenderTarget(const Resource::Ref& rt, const Color& color, UINT view = 0);
 		void clearDepth(const Resource::Ref& rt, float depth);
 		void clearStencil(const Resource::Ref& rt, UINT8  stencil);
 		void clearDepthStencil(const Resource::Ref& rt, float depth, UINT8 stencil);
@@ -673,8 +810,18 @@ public:
 			D3D12_RESOURCE_STATES state;
 			UINT subresource;
 		};
-		std::unordered_map<ID3D12Resource*,Transition> mTransitionBarrier;
+		// one pending transition per subresource, all subresources sort after the single ones
+		std::map<std::pair<ID3D12Resource*, UINT>,Transition> mTransitionBarrier;
 		std::unordered_map<ID3D12Resource*, Resource::Ref> mUAVBarrier;
+		struct ExplicitTransition
+		{
+			Resource::Ref res;
+			D3D12_RESOURCE_STATES before;
+			D3D12_RESOURCE_STATES after;
+			D3D12_RESOURCE_BARRIER_FLAGS flags;
+			UINT subresource;
+		};
+		std::vector<ExplicitTransition> mExplicitBarrier;
 		bool mOpening = false;
 	};
 
@@ -708,17 +855,32 @@ public:
 	class CommandQueue : public Interface<CommandQueue>
 	{
 	public:
-		using Command = std::function<void(CommandList*)>;
-		using CoroutineCommand = std::function<Future<Promise>(CommandList*)>;
+		using Command = UniqueFunction<void(CommandList*)>;
+		using CoroutineCommand = UniqueFunction<Future<Promise>(CommandList*)>;
 
 	public:
-		CommandQueue(D3D12_COMMAND_LIST_TYPE type, size_t maxCmdlistSize = NUM_COMMANDLISTS, asio::io_context& context = Dispatcher::getSharedContext());
+		// commands are recorded in the dispatcher lane of priority
+		CommandQueue(D3D12_COMMAND_LIST_TYPE type, size_t maxCmdlistSize = NUM_COMMANDLISTS, DispatchPriority priority = DP_CRITICAL, asio::io_context& context = Dispatcher::getSharedContext());
 		~CommandQueue();
 
 		void addCommand(Command&& task, bool strand = false);
 		void addCoroutineCommand(CoroutineCommand&& task, bool strand = false);
 
+		struct SyncPoint
+		{
+			using Ptr = std::shared_ptr<SyncPoint>;
+			Fence::Ptr fence;
+			// 0 until the signal is submitted
+			UINT64 value = 0;
+		};
+		// cross-queue synchronization between the commands added so far and the following ones,
+		// resolved when the queues are executed. only meaningful on the thread that adds the commands.
+		SyncPoint::Ptr addSignal();
+		void addWait(const SyncPoint::Ptr& point);
+
 		
+		using CommandListSlot = CommandListRing<CommandList>::Slot;
+
 		struct CommandListWrapper
 		{
 			CommandListWrapper( CommandQueue* queue);
@@ -733,9 +895,15 @@ public:
 				return cmdlist;
 			}
 			CommandList* cmdlist;
+		private:
+			CommandQueue* queue;
+			CommandListSlot slot;
 		};
-		CommandList& acquireComandList();
+		// the slot has to be published once recording is done, it is submitted in acquisition order
+		CommandListSlot acquireComandList();
 		void execute();
+		// executes queues whose commands wait for each other
+		static void execute(const std::vector<CommandQueue::Ref>& queues);
 		void flush();
 		ID3D12CommandQueue* get();
 
@@ -745,12 +913,26 @@ public:
 
 		Fence::Ref getFence();
 	private:
-		std::vector<CommandList> mCommandLists;
+		void collect();
+		// submits up to the first wait whose signal is not submitted yet, returns true once everything is submitted.
+		// skipWaits drops such waits instead, for queues that would wait forever
+		bool submit(bool skipWaits = false);
+
+		std::unique_ptr<CommandListRing<CommandList>> mCommandLists;
 		std::vector<ID3D12CommandList*> mOriginCommandLists;
-		size_t mMaxCommandListSize;
+
+		struct Marker
+		{
+			// number of command lists before the marker
+			size_t position;
+			SyncPoint::Ptr point;
+			bool signal;
+		};
+		std::vector<Marker> mMarkers;
+		size_t mNextMarker = 0;
+		size_t mNumSubmitted = 0;
 
 		ComPtr<ID3D12CommandQueue> mQueue;
-		std::atomic<size_t> mUsedCommandListsCount = 0;
 		TaskExecutor mTaskExecutor{ Dispatcher::getSharedContext() };
 		Fence::Ptr mFence;
 		std::mutex mMutex;
@@ -760,6 +942,33 @@ public:
 	using RenderTask = CommandQueue::Command;
 	using ObjectTask = std::function<void()>;
 
+	// texture of createTextureFromFileAsync, it stands for its placeholder until the file is loaded and uploaded
+	class StreamedTexture: public Interface<StreamedTexture>
+	{
+		friend class Renderer;
+	public:
+		// render thread only
+		Resource::Ref get()const { return mReady ? mTexture : mPlaceholder; }
+		bool isReady()const { return mReady; }
+		const std::string& getName()const { return mName; }
+	private:
+		std::string mName;
+		bool mSRGB = false;
+		Resource::Ref mPlaceholder;
+		Resource::Ref mTexture;
+		bool mReady = false;
+
+		// runs only the decode of this file, so that createTextureFromFile can block on it alone.
+		// released once the texture is decoded
+		TaskExecutor::Ptr mLoader;
+		// written by the worker that decodes the file
+		std::atomic<bool> mDecoded = false;
+		void* mData = nullptr;
+		int mWidth = 0;
+		int mHeight = 0;
+		DXGI_FORMAT mFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
+	};
+
 
 	static Renderer::Ptr create();
 	static void destory();
@@ -780,17 +989,27 @@ public:
 	const DebugInfo& getDebugInfo()const;
 	HWND getWindow()const;
 	ID3D12Device* getDevice();
+	HeapManager::Ref getHeapManager();
 	CommandQueue::Ref getRenderQueue();
 	CommandQueue::Ref getComputeQueue();
 	Resource::Ref getBackBuffer();
 	UINT getCurrentFrameIndex();
-	void updateResource(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT)>& copy);
+	// frames are numbered from 0 in the order they end, the gpu has finished every frame below getCompletedFrame()
+	UINT64 getFrameNumber()const;
+	UINT64 getCompletedFrame();
+	// copy gets the upload buffer and the offset of the data in it
+	void updateResource(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT64, UINT)>& copy);
 	void updateBuffer(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size);
 	void updateTexture(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, bool srgb);
 	void executeResourceCommands(RenderTask&& dofunc);
 
 	Shader::Ptr compileShaderFromFile(const std::string& path, const std::string& entry, const std::string& target, const std::vector<D3D_SHADER_MACRO>& macros = {});
 	Shader::Ptr compileShader(const std::string& name, const std::string& context, const std::string& entry, const std::string& target, const std::vector<D3D_SHADER_MACRO>& macros = {}, const std::string& cachename = {});
+	// compiles in the background lane, callback runs on the thread that finished compiling
+	void compileShaderAsync(const std::string& name, const std::string& context, const std::string& entry, const std::string& target, UniqueFunction<void(Shader::Ptr)>&& callback, const std::vector<D3D_SHADER_MACRO>& macros = {});
+	// the file is read on the calling thread
+	void compileShaderFromFileAsync(const std::string& path, const std::string& entry, const std::string& target, UniqueFunction<void(Shader::Ptr)>&& callback, const std::vector<D3D_SHADER_MACRO>& macros = {});
+	TaskExecutor& getBackgroundExecutor();
 	Fence::Ptr createFence();
 	// resource 
 	void destroyResource(Resource::Ref res);
@@ -801,6 +1020,11 @@ public:
 	Resource::Ref createTextureCube(UINT size, DXGI_FORMAT format, UINT nummips = 1, D3D12_HEAP_TYPE type = D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
 	Resource::Ref createTextureCubeArray(UINT size, DXGI_FORMAT format, UINT arraySize, UINT nummips = 1, D3D12_HEAP_TYPE type = D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
 	Resource::Ref createTextureFromFile(const std::string& filename, bool srgb);
+	// returns at once, the file is read and decoded in the background lane.
+	// copies and mips of the textures decoded by the end of a frame are recorded into one resource command list,
+	// the texture replaces the placeholder (a white texel by default) once the resource queue is done with it.
+	// requests for a file that is loaded or still loading share its handle
+	StreamedTexture::Ptr createTextureFromFileAsync(const std::string& filename, bool srgb, Resource::Ref placeholder = {});
 	Resource::Ref createTexture3D(UINT width, UINT height, UINT depth, DXGI_FORMAT format, UINT miplevels = 1, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE, D3D12_HEAP_TYPE type = D3D12_HEAP_TYPE_DEFAULT);
 	// buffer
 	Resource::Ref createBufferBase(size_t size, bool isShaderResource,D3D12_HEAP_TYPE type );
@@ -818,6 +1042,7 @@ private:
 	{
 		return MemoryData(new std::vector<char>(size));
 	}
+	std::string readShaderFile(const std::string& path);
 
 	void uninitialize();
 	void initDevice();
@@ -844,6 +1069,13 @@ private:
 
 	void addUploadingResource(Resource::Ptr res);
 	void processUploadingResource();
+
+	// write the data to upload now, the task records the copy
+	RenderTask prepareResourceUpdate(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, const std::function<void(CommandList *, Resource::Ref, UINT64, UINT)>& copy);
+	RenderTask prepareTextureUpdate(Resource::Ref res, UINT subresource, const void* buffer, UINT64 size, bool srgb);
+	RenderTask prepareMips(Resource::Ref texture);
+	// with wait the decoded textures are uploaded at once and ready when it returns
+	void processStreamingTextures(bool wait = false);
 private:
 	static Renderer::Ptr instance;
 
@@ -856,16 +1088,28 @@ private:
 	CommandQueue::Ptr mComputeQueue;
 	CommandQueue::Ptr mResourceQueue;
 	CommandQueue::Ptr mTimerQueue;
+	TaskExecutor::Ptr mBackgroundTasks;
 
 
 	UINT mCurrentFrame;
+	std::atomic<UINT64> mFrameNumber = 0;
+	// signalled once per frame on the render queue, its value is the number of frames the gpu finished
+	Fence::Ptr mFrameFence;
 
 
 	std::array< Resource::Ptr, NUM_BACK_BUFFERS> mBackbuffers;
 	std::array<DescriptorHeap::Ptr, DHT_MAX_NUM> mDescriptorHeaps;
 	std::set<Resource::Ptr> mResources;
 
-	std::unordered_map<std::string, Resource::Ref> mTextureMap;
+	std::unordered_map<std::string, StreamedTexture::Ptr> mTextureMap;
+	Resource::Ref mDefaultPlaceholder;
+	std::list<StreamedTexture::Ptr> mDecodingTextures;
+	struct StreamingBatch
+	{
+		std::vector<StreamedTexture::Ptr> textures;
+		Fence::Ptr fence;
+	};
+	std::list<StreamingBatch> mStreamingBatches;
 	std::unordered_map<size_t, PipelineState> mPipelineStates;
 	ComPtr<ID3D12QueryHeap> mTimeStampQueryHeap;
 	std::vector<Profile::Ptr> mProfiles;
@@ -873,6 +1117,8 @@ private:
 	Resource::Ref mProfileReadBack;
 	//CommandAllocator::Ptr mProfileCmdAlloc;
 	ConstantBufferAllocator::Ptr mConstantBufferAllocator;
+	UploadRing::Ptr mUploadRing;
+	HeapManager::Ptr mHeapManager;
 	std::array<PipelineStateInstance::Ptr, 4> mGenMipsPSO;
 	PipelineStateInstance::Ptr mSRGBConv;
 	bool mVSync = false;
@@ -3,81 +3,171 @@
 
 ResourceViewAllocator ResourceViewAllocator::Singleton;
 
-std::pair<Renderer::Resource::Ref, size_t> ResourceViewAllocator::alloc(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv)
+std::pair<Renderer::Resource::Ref, size_t> ResourceViewAllocator::alloc(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips)
 {
-	auto hv = hash(width, height, depth, format, type, cv);
-	auto& stack = mResources[hv];
-	if (stack.empty())
+	auto hv = hash(width, height, depth, format, type, cv, mips);
+	auto completed = Renderer::getSingleton()->getCompletedFrame();
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto stack = mResources.find(hv);
+	if (stack != mResources.end())
 	{
-		D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE;
-
-		switch (type)
+		// the latest recycled view the gpu is done with, so the same slots tend to get the same views
+		for (auto i = stack->second.rbegin(); i != stack->second.rend(); ++i)
 		{
-		case Renderer::VT_RENDERTARGET: flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET; break;
-		case Renderer::VT_DEPTHSTENCIL: flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL; break;
-		case Renderer::VT_UNORDEREDACCESS: flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS; break;
+			if ((*i)->frame >= completed)
+				continue;
+			auto res = (*i)->res;
+			remove(*i);
+			mStats.reused++;
+			return {res, hv};
 		}
+		mStats.inFlight++;
+	}
+
+	mStats.created++;
+	// still under the lock, the renderer does not create resources concurrently
+	return {create(width, height, depth, format, type, cv, mips), hv};
+}
+
+Renderer::Resource::Ref ResourceViewAllocator::create(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips)
+{
+	D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE;
+
+	switch (type)
+	{
+	case Renderer::VT_RENDERTARGET: flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET; break;
+	case Renderer::VT_DEPTHSTENCIL: flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL; break;
+	case Renderer::VT_UNORDEREDACCESS: flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS; break;
+	}
 
-		Renderer::Resource::Ref res;
-		if (depth == 1)
-			res = Renderer::getSingleton()->createTexture2DBase(width, height, depth, format,1,D3D12_HEAP_TYPE_DEFAULT, flags,cv);
-		else
-			res = Renderer::getSingleton()->createTexture3D(width, height, depth, format, 1, flags, D3D12_HEAP_TYPE_DEFAULT);
-		switch (type)
+	Renderer::Resource::Ref res;
+	if (depth == 1)
+		res = Renderer::getSingleton()->createTexture2DBase(width, height, depth, format,mips,D3D12_HEAP_TYPE_DEFAULT, flags,cv);
+	else
+		res = Renderer::getSingleton()->createTexture3D(width, height, depth, format, mips, flags, D3D12_HEAP_TYPE_DEFAULT);
+	auto& resdesc = res->getDesc();
+	switch (type)
+	{
+	case Renderer::VT_RENDERTARGET: 
+		{
+			res->createRenderTargetView(NULL); 
+			res->createShaderResource(NULL); 
+			// view i renders to mip i
+			for (UINT i = 1; i < resdesc.MipLevels; ++i)
+			{
+				D3D12_RENDER_TARGET_VIEW_DESC desc = {};
+				desc.Format = resdesc.Format;
+				desc.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
+				desc.Texture2D.MipSlice = i;
+				res->createRenderTargetView(&desc, i);
+			}
+			break;
+		}
+	case Renderer::VT_DEPTHSTENCIL: 
 		{
-		case Renderer::VT_RENDERTARGET: 
+			auto [srvfmt, dsvfmt] = D3DHelper::matchReadableDepthFormat(format);
 			{
-				res->createRenderTargetView(NULL); 
-				res->createShaderResource(NULL); 
-				break;
+				D3D12_DEPTH_STENCIL_VIEW_DESC desc = {};
+				desc.Format = dsvfmt;
+				desc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+				desc.Flags = D3D12_DSV_FLAG_NONE;
+				desc.Texture2D.MipSlice = 0;
+				res->createDepthStencilView(&desc);
 			}
-		case Renderer::VT_DEPTHSTENCIL: 
+		
+			if (srvfmt != DXGI_FORMAT_UNKNOWN)
+			{
+				D3D12_SHADER_RESOURCE_VIEW_DESC desc = {};
+				desc.Format = srvfmt;
+				desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+				desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+				desc.Texture2D.MostDetailedMip = 0;
+				desc.Texture2D.MipLevels = -1;
+				res->createShaderResource(&desc);
+			}
+		}
+		break;
+	case Renderer::VT_UNORDEREDACCESS: 
+		{
+			res->createUnorderedAccessView(NULL); 
+			res->createShaderResource(NULL);
+			for (UINT i = 1; i < resdesc.MipLevels; ++i)
 			{
-				auto [srvfmt, dsvfmt] = D3DHelper::matchReadableDepthFormat(format);
+				D3D12_UNORDERED_ACCESS_VIEW_DESC desc = {};
+				desc.Format = resdesc.Format;
+				if (depth == 1)
 				{
-					D3D12_DEPTH_STENCIL_VIEW_DESC desc = {};
-					desc.Format = dsvfmt;
-					desc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
-					desc.Flags = D3D12_DSV_FLAG_NONE;
-					desc.Texture2D.MipSlice = 0;
-					res->createDepthStencilView(&desc);
+					desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+					desc.Texture2D.MipSlice = i;
 				}
-			
-				if (srvfmt != DXGI_FORMAT_UNKNOWN)
+				else
 				{
-					D3D12_SHADER_RESOURCE_VIEW_DESC desc = {};
-					desc.Format = srvfmt;
-					desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-					desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-					desc.Texture2D.MostDetailedMip = 0;
-					desc.Texture2D.MipLevels = -1;
-					res->createShaderResource(&desc);
+					desc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE3D;
+					desc.Texture3D.MipSlice = i;
+					desc.Texture3D.WSize = -1;
 				}
+				res->createUnorderedAccessView(&desc, i);
 			}
 			break;
-		case Renderer::VT_UNORDEREDACCESS: 
-			{
-				res->createUnorderedAccessView(NULL); 
-				res->createShaderResource(NULL);
-				break;
-			}
 		}
-
-		return {res, hv};
 	}
-	auto res = stack.back();
-	stack.pop_back();
-	return {res, hv};
+
+	return res;
 }
 
 void ResourceViewAllocator::recycle(Renderer::Resource::Ref res, size_t hashvalue)
 {
 	auto& desc = res->getDesc();
-	auto hv = hashvalue ? hashvalue : hash(desc.Width, desc.Height, desc.DepthOrArraySize, desc.Format, res->getViewType(),res->getClearValue());
-	mResources[hv].emplace_back(std::move(res));
+	auto hv = hashvalue ? hashvalue : hash(desc.Width, desc.Height, desc.DepthOrArraySize, desc.Format, res->getViewType(),res->getClearValue(), desc.MipLevels);
+	auto size = Renderer::getSingleton()->getDevice()->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes;
+	// work of the current frame may still use it
+	auto frame = Renderer::getSingleton()->getFrameNumber();
+	std::lock_guard<std::mutex> lock(mMutex);
+	mIdle.push_back({std::move(res), hv, size, frame});
+	mResources[hv].push_back(std::prev(mIdle.end()));
+	mStats.pooledViews++;
+	mStats.pooledBytes += size;
+}
+
+void ResourceViewAllocator::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mBudget = bytes;
+}
+
+void ResourceViewAllocator::trim()
+{
+	CHECK_RENDER_THREAD;
+	auto renderer = Renderer::getSingleton();
+	std::lock_guard<std::mutex> lock(mMutex);
+	// the renderer keeps destroyed resources alive until the gpu is done with them
+	while (mStats.pooledBytes > mBudget && !mIdle.empty())
+	{
+		auto res = mIdle.front().res;
+		remove(mIdle.begin());
+		renderer->destroyResource(res);
+		mStats.evicted++;
+	}
+}
+
+ResourceViewAllocator::Stats ResourceViewAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
+
+void ResourceViewAllocator::remove(Entries::iterator entry)
+{
+	auto& stack = mResources[entry->hash];
+	stack.erase(std::find(stack.begin(), stack.end(), entry));
+	if (stack.empty())
+		mResources.erase(entry->hash);
+	mStats.pooledViews--;
+	mStats.pooledBytes -= entry->size;
+	mIdle.erase(entry);
 }
 
-size_t ResourceViewAllocator::hash(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv)
+size_t ResourceViewAllocator::hash(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips)
 {
 	auto cal = [=](){
 		size_t value = 0;
@@ -91,6 +181,7 @@ size_t ResourceViewAllocator::hash(UINT width, UINT height, UINT depth, DXGI_FOR
 		combine(depth);
 		combine(format);
 		combine(type) ;
+		combine(mips);
 		
 		for (auto c: cv.color)
 			combine(c);
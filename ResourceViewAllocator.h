@@ -1,18 +1,59 @@
 #pragma once
 
 #include "Renderer.h"
+#include <list>
 
+// pool of render targets, depth stencils and unordered access textures, shared by equal descriptions.
+// a recycled view is only handed out again once the gpu finished the frame it was recycled in,
+// idle views above the budget are destroyed from the least recently recycled one.
 class ResourceViewAllocator
 {
 public:
 	static ResourceViewAllocator Singleton;
 
-	std::pair<Renderer::Resource::Ref, size_t> alloc(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv);
+	struct Stats
+	{
+		size_t reused = 0;
+		size_t created = 0;
+		// created while views of the description were pooled, but still in use by the gpu
+		size_t inFlight = 0;
+		size_t evicted = 0;
+		size_t pooledViews = 0;
+		size_t pooledBytes = 0;
+	};
+
+	// thread safe. render target and unordered access views of index i are bound to mip i
+	std::pair<Renderer::Resource::Ref, size_t> alloc(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips = 1);
+	// thread safe, e.g. from handles dying on the workers
 	void recycle(Renderer::Resource::Ref res, size_t hashvalue = 0);
+	// views of equal hash are interchangeable
+	size_t hash(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips = 1);
 
-private:
-	size_t hash(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv);
+	// bytes of idle views kept by the pool
+	void setBudget(size_t bytes);
+	// destroys the idle views above the budget, on the render thread since the renderer owns them
+	void trim();
+	Stats getStats();
 
 private:
-	std::map<size_t, std::vector<Renderer::Resource::Ref>> mResources;
-};
\ No newline at end of file
+	struct Entry
+	{
+		Renderer::Resource::Ref res;
+		size_t hash;
+		size_t size;
+		// frame the view was recycled in, the gpu may use it until that frame completes
+		UINT64 frame;
+	};
+	using Entries = std::list<Entry>;
+
+	Renderer::Resource::Ref create(UINT width, UINT height, UINT depth, DXGI_FORMAT format, Renderer::ViewType type, Renderer::ClearValue cv, UINT mips);
+	void remove(Entries::iterator entry);
+
+	std::mutex mMutex;
+	// idle views in recycle order, the front is the least recently used
+	Entries mIdle;
+	// idle views of each hash in recycle order
+	std::map<size_t, std::vector<Entries::iterator>> mResources;
+	size_t mBudget = 512 * 1024 * 1024;
+	Stats mStats;
+};
@@ -0,0 +1,295 @@
+#include "Scheduler.h"
+#include <cassert>
+
+thread_local Scheduler::WorkerContext Scheduler::CurrentWorker;
+
+Scheduler::WorkQueue::Buffer::Buffer(int64_t capacity):
+	mask(capacity - 1), slots(new std::atomic<Job*>[capacity])
+{
+}
+
+Scheduler::WorkQueue::WorkQueue()
+{
+	mBuffers.emplace_back(new Buffer(INITIAL_CAPACITY));
+	mBuffer.store(mBuffers.back().get(), std::memory_order_relaxed);
+}
+
+Scheduler::WorkQueue::~WorkQueue()
+{
+	while (auto job = pop())
+		delete job;
+}
+
+void Scheduler::WorkQueue::push(Job* job)
+{
+	auto b = mBottom.load(std::memory_order_relaxed);
+	auto t = mTop.load(std::memory_order_acquire);
+	auto buffer = mBuffer.load(std::memory_order_relaxed);
+	if (b - t > buffer->capacity() - 1)
+	{
+		auto grown = new Buffer(buffer->capacity() * 2);
+		for (auto i = t; i < b; ++i)
+			grown->put(i, buffer->get(i));
+		mBuffers.emplace_back(grown);
+		mBuffer.store(grown, std::memory_order_release);
+		buffer = grown;
+	}
+	buffer->put(b, job);
+	std::atomic_thread_fence(std::memory_order_release);
+	mBottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Scheduler::Job* Scheduler::WorkQueue::pop()
+{
+	auto b = mBottom.load(std::memory_order_relaxed) - 1;
+	auto buffer = mBuffer.load(std::memory_order_relaxed);
+	mBottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto t = mTop.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		mBottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = buffer->get(b);
+	if (t == b)
+	{
+		// last one, race against thieves
+		if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		mBottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Scheduler::Job* Scheduler::WorkQueue::steal()
+{
+	auto t = mTop.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto b = mBottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return nullptr;
+
+	auto buffer = mBuffer.load(std::memory_order_acquire);
+	Job* job = buffer->get(t);
+	if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+
+Scheduler::Lane::~Lane()
+{
+	for (auto job : mJobs)
+		delete job;
+}
+
+void Scheduler::Lane::push(Job* job)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mJobs.push_back(job);
+	mSize.fetch_add(1, std::memory_order_release);
+}
+
+Scheduler::Job* Scheduler::Lane::pop()
+{
+	if (empty())
+		return nullptr;
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mJobs.empty())
+		return nullptr;
+	auto job = mJobs.front();
+	mJobs.pop_front();
+	mSize.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+
+Scheduler::Strand::State::~State()
+{
+	for (auto job : jobs)
+		delete job;
+}
+
+Scheduler::Strand::Strand(Scheduler& scheduler, DispatchPriority priority):
+	mScheduler(scheduler), mState(new State())
+{
+	mState->priority = priority;
+}
+
+void Scheduler::Strand::push(Job* job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mState->mutex);
+		mState->jobs.push_back(job);
+		if (mState->running)
+			return;
+		mState->running = true;
+	}
+
+	mScheduler.post([scheduler = &mScheduler, state = mState]() {
+		drain(scheduler, state);
+	}, mState->priority);
+}
+
+void Scheduler::Strand::drain(Scheduler* scheduler, std::shared_ptr<State> state)
+{
+	// run a limited batch and then yield the worker, so one busy strand cannot starve the others
+	static const int MAX_BATCH = 32;
+	for (int i = 0; i < MAX_BATCH; ++i)
+	{
+		Job* job = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (state->jobs.empty())
+			{
+				state->running = false;
+				return;
+			}
+			job = state->jobs.front();
+			state->jobs.pop_front();
+		}
+		std::unique_ptr<Job> holder(job);
+		holder->run();
+	}
+
+	auto priority = state->priority;
+	scheduler->post([scheduler, state = std::move(state)]() {
+		drain(scheduler, state);
+	}, priority);
+}
+
+
+Scheduler::Scheduler(size_t numWorkers)
+{
+	mWorkers.reserve(numWorkers);
+	for (size_t i = 0; i < numWorkers; ++i)
+		mWorkers.emplace_back(new WorkQueue());
+}
+
+Scheduler::~Scheduler()
+{
+	stop();
+}
+
+void Scheduler::push(Job* job, DispatchPriority priority)
+{
+	mPendingCount.fetch_add(1, std::memory_order_seq_cst);
+
+	if (priority == DP_NORMAL && CurrentWorker.scheduler == this)
+		mWorkers[CurrentWorker.index]->push(job);
+	else
+		mLanes[priority].push(job);
+
+	notify();
+}
+
+void Scheduler::run(size_t index)
+{
+	assert(index < mWorkers.size() && "invalid worker index");
+	CurrentWorker = { this, index };
+
+	while (!mStopped.load(std::memory_order_acquire))
+	{
+		if (auto job = findJob(index))
+			execute(job);
+		else
+			park();
+	}
+
+	CurrentWorker = {};
+}
+
+bool Scheduler::poll_one(bool block)
+{
+	while (true)
+	{
+		Job* job = nullptr;
+		if (CurrentWorker.scheduler == this)
+			job = findJob(CurrentWorker.index);
+		else if (!(job = mLanes[DP_CRITICAL].pop()) &&
+			!(job = mLanes[DP_NORMAL].pop()) &&
+			!(job = stealJob(0)))
+			job = mLanes[DP_BACKGROUND].pop();
+
+		if (job)
+		{
+			execute(job);
+			return true;
+		}
+		if (!block || mStopped.load(std::memory_order_acquire))
+			return false;
+		// every pending job can be reached from here, so the count going up is worth another look
+		park();
+	}
+}
+
+void Scheduler::stop()
+{
+	mStopped.store(true, std::memory_order_release);
+	std::lock_guard<std::mutex> lock(mSleepMutex);
+	mSleepCondVar.notify_all();
+}
+
+bool Scheduler::isWorkerThread() const
+{
+	return CurrentWorker.scheduler == this;
+}
+
+Scheduler::Job* Scheduler::findJob(size_t index)
+{
+	if (auto job = mLanes[DP_CRITICAL].pop())
+		return job;
+	// starvation protection, a steady stream of normal jobs still lets background ones through
+	if (++CurrentWorker.ticks % BACKGROUND_INTERVAL == 0)
+	{
+		if (auto job = mLanes[DP_BACKGROUND].pop())
+			return job;
+	}
+	if (auto job = mWorkers[index]->pop())
+		return job;
+	if (auto job = mLanes[DP_NORMAL].pop())
+		return job;
+	if (auto job = stealJob(index + 1))
+		return job;
+	return mLanes[DP_BACKGROUND].pop();
+}
+
+Scheduler::Job* Scheduler::stealJob(size_t start)
+{
+	auto count = mWorkers.size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (auto job = mWorkers[(start + i) % count]->steal())
+			return job;
+	}
+	return nullptr;
+}
+
+void Scheduler::execute(Job* job)
+{
+	mPendingCount.fetch_sub(1, std::memory_order_relaxed);
+	std::unique_ptr<Job> holder(job);
+	holder->run();
+}
+
+void Scheduler::notify()
+{
+	if (mSleepingCount.load(std::memory_order_seq_cst) == 0)
+		return;
+	std::lock_guard<std::mutex> lock(mSleepMutex);
+	mSleepCondVar.notify_one();
+}
+
+void Scheduler::park()
+{
+	std::unique_lock<std::mutex> lock(mSleepMutex);
+	mSleepingCount.fetch_add(1, std::memory_order_seq_cst);
+	mSleepCondVar.wait(lock, [this]() {
+		return mPendingCount.load(std::memory_order_seq_cst) > 0 || mStopped.load(std::memory_order_acquire);
+	});
+	mSleepingCount.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Function.h"
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <condition_variable>
+
+enum DispatchPriority
+{
+	// work the current frame is waiting for, e.g. command recording
+	DP_CRITICAL,
+	DP_NORMAL,
+	// loading and compiling, may span several frames
+	DP_BACKGROUND,
+
+	DP_COUNT,
+};
+
+// work-stealing scheduler:
+// every worker owns a deque, pops its own jobs LIFO and steals from the others FIFO.
+// jobs posted from non-worker threads go through a shared injection queue.
+// critical and background jobs have their own shared lanes, critical ones are always taken first
+// and every BACKGROUND_INTERVAL-th job of a worker is taken from the background lane if it has any.
+class Scheduler
+{
+public:
+	using Ptr = std::shared_ptr<Scheduler>;
+	static const uint32_t BACKGROUND_INTERVAL = 16;
+
+	class Job
+	{
+	public:
+		Job(UniqueFunction<void()>&& handler) : mHandler(std::move(handler)) {}
+		void run() { mHandler(); }
+	private:
+		UniqueFunction<void()> mHandler;
+	};
+
+	// locked FIFO, emptiness is checked without the lock
+	class Lane
+	{
+	public:
+		~Lane();
+		void push(Job* job);
+		Job* pop();
+		bool empty()const { return mSize.load(std::memory_order_acquire) == 0; }
+	private:
+		std::mutex mMutex;
+		std::deque<Job*> mJobs;
+		std::atomic<int64_t> mSize = 0;
+	};
+
+	// serializes the jobs posted through it, the same way asio::io_context::strand does
+	class Strand
+	{
+	public:
+		// the strand runs as a whole in the lane of priority
+		Strand(Scheduler& scheduler, DispatchPriority priority = DP_NORMAL);
+
+		template<class Handler>
+		void post(Handler&& handler)
+		{
+			push(new Job(std::move(handler)));
+		}
+		void push(Job* job);
+	private:
+		struct State
+		{
+			std::mutex mutex;
+			std::deque<Job*> jobs;
+			bool running = false;
+			DispatchPriority priority = DP_NORMAL;
+			~State();
+		};
+		static void drain(Scheduler* scheduler, std::shared_ptr<State> state);
+
+		Scheduler& mScheduler;
+		std::shared_ptr<State> mState;
+	};
+
+	Scheduler(size_t numWorkers);
+	~Scheduler();
+
+	template<class Handler>
+	void post(Handler&& handler, DispatchPriority priority = DP_NORMAL)
+	{
+		push(new Job(std::move(handler)), priority);
+	}
+	void push(Job* job, DispatchPriority priority = DP_NORMAL);
+
+	// worker loop, index must be in [0, getNumWorkers())
+	void run(size_t index);
+	// runs one pending job on the calling thread, returns false if nothing was found.
+	// block sleeps with the workers until there is one, it only returns false once stopped
+	bool poll_one(bool block = false);
+	void stop();
+
+	size_t getNumWorkers()const { return mWorkers.size(); }
+	bool isWorkerThread()const;
+private:
+	// Chase-Lev deque, push/pop by the owner, steal by anyone
+	class WorkQueue
+	{
+	public:
+		WorkQueue();
+		~WorkQueue();
+
+		void push(Job* job);
+		Job* pop();
+		Job* steal();
+	private:
+		struct Buffer
+		{
+			int64_t mask;
+			std::unique_ptr<std::atomic<Job*>[]> slots;
+
+			Buffer(int64_t capacity);
+			Job* get(int64_t i)const { return slots[i & mask].load(std::memory_order_relaxed); }
+			void put(int64_t i, Job* job) { slots[i & mask].store(job, std::memory_order_relaxed); }
+			int64_t capacity()const { return mask + 1; }
+		};
+		static const int64_t INITIAL_CAPACITY = 1024;
+
+		alignas(64) std::atomic<int64_t> mTop = 0;
+		alignas(64) std::atomic<int64_t> mBottom = 0;
+		alignas(64) std::atomic<Buffer*> mBuffer;
+		// thieves may still read a replaced buffer, keep them until the queue dies
+		std::vector<std::unique_ptr<Buffer>> mBuffers;
+	};
+
+	Job* findJob(size_t index);
+	Job* stealJob(size_t start);
+	void execute(Job* job);
+	void notify();
+	void park();
+
+private:
+	struct WorkerContext
+	{
+		Scheduler* scheduler = nullptr;
+		size_t index = 0;
+		uint32_t ticks = 0;
+	};
+	static thread_local WorkerContext CurrentWorker;
+
+	std::vector<std::unique_ptr<WorkQueue>> mWorkers;
+
+	// the normal lane is the injection queue for non-worker threads
+	Lane mLanes[DP_COUNT];
+
+	std::atomic<int64_t> mPendingCount = 0;
+	std::atomic<int64_t> mSleepingCount = 0;
+	std::atomic_bool mStopped = false;
+	std::mutex mSleepMutex;
+	std::condition_variable mSleepCondVar;
+};
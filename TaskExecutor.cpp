@@ -1,77 +1,202 @@
 #include "TaskExecutor.h"
-#include <iostream>
-struct Test
+
+void TaskExecutor::addTask(UniqueFunction<void()>&& task, bool strand)
 {
-	int index;
-	Test()
-	{
-		index = i++;
-		std::cout << "ctor" << index << std::endl;
-	}
-	Test(const Test& t)
+	addCoroutineTask([](UniqueFunction<void()> t)->Future
 	{
-		index = t.index;
-		std::cout << "copy lv" << index << std::endl;
-	}
+		co_await std::suspend_always();
+		t();
+		co_return;
+	}, strand, std::move(task));
+}
 
-	Test(Test&& t)
+void TaskExecutor::addTask(Task&& task, bool strand)
+{
+	if (strand)
 	{
-		index= t.index;
-		std::cout << "copy rv" << index << std::endl;
+		{
+			std::lock_guard<std::mutex> lock(mPending->mutex);
+			mPending->strandTasks.emplace_back(std::move(task));
+		}
+		// the strand runs its runners in order, each one takes the oldest strand task
+		mDispatcher.invoke_strand([pending = mPending]() {
+			runPendingStrandTask(*pending);
+		});
 	}
-	~Test()
+	else
 	{
-		std::cout << "dctor" << index << std::endl;
-		index = 0xffffffff;
+		{
+			std::lock_guard<std::mutex> lock(mPending->mutex);
+			mPending->tasks.emplace_back(std::move(task));
+		}
+		mDispatcher.invoke([pending = mPending]() {
+			runPendingTask(*pending);
+		});
 	}
+}
 
-	void f()const
-	{
+bool TaskExecutor::runPendingTask()
+{
+	return runPendingTask(*mPending);
+}
 
-	}
-	static int i;
-};
+bool TaskExecutor::runPendingTask(PendingTasks& pending)
+{
+	std::unique_lock<std::mutex> lock(pending.mutex);
+	if (pending.tasks.empty())
+		return false;
+	auto task = std::move(pending.tasks.front());
+	pending.tasks.pop_front();
+	lock.unlock();
+
+	task();
+	return true;
+}
 
-int Test::i = 0;
 
-void TaskExecutor::addTask(std::function<void()>&& task, bool strand)
+bool TaskExecutor::runPendingStrandTask(PendingTasks& pending)
 {
-	//auto task_func = [](std::function<void> t)->Future
-	//{
-	//	co_return;
-	//};
+	std::unique_lock<std::mutex> lock(pending.mutex);
+	if (pending.strandTasks.empty())
+		return false;
+	auto task = std::move(pending.strandTasks.front());
+	pending.strandTasks.pop_front();
+	lock.unlock();
 
-	addCoroutineTask([](std::function<void()> t)->Future
-	{
-		co_await std::suspend_always();
-		t();
-		co_return;
-	}, strand, std::move(task));
+	task();
+	return true;
 }
 
-void TaskExecutor::addTask(Task&& task, bool strand)
+
+void TaskExecutor::finishTask(Task& task)
 {
-	if (strand)
+	if (task.mContinuation)
+		(*task.mContinuation)();
+	// release pairs with the acquire loads in wait(), the waiter sees everything the task wrote
+	if (mTaskCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		mTaskCount.notify_all();
+}
+
+void TaskExecutor::Task::operator()()
+{
+	if (!mCoroutine.isValid())
+		return;
+
+	// a coroutine that awaited before its first run is parked without resuming it
+	auto& promise = mCoroutine.getPromise();
+	if (!promise.isParked())
+		mCoroutine.resume();
+
+	if (mCoroutine.done())
+	{
+		mExecutor->finishTask(*this);
+	}
+	else if (auto park = promise.takePark())
 	{
-		mDispatcher.invoke_strand(std::move(task));
+		// the coroutine is waiting on an awaitable, requeue only once it is signalled
+		park.list->park([task = std::move(*this)]() mutable {
+			auto executor = task.mExecutor;
+			auto strand = task.mStrand;
+			executor->addTask(std::move(task), strand);
+		}, park.ready);
 	}
 	else
 	{
-		mDispatcher.invoke(std::move(task));
+		mExecutor->addTask(std::move(*this), mStrand);
 	}
 }
 
+TaskExecutor::TaskExecutor(asio::io_context& context, DispatchPriority priority):
+	mContext(context), mDispatcher(context, priority)
+{
+}
 
+TaskExecutor::~TaskExecutor()
+{
+	// destroyed outside the lock, a coroutine frame may hold anything
+	std::deque<Task> tasks;
+	std::deque<Task> strandTasks;
+	{
+		std::lock_guard<std::mutex> lock(mPending->mutex);
+		tasks.swap(mPending->tasks);
+		strandTasks.swap(mPending->strandTasks);
+	}
+}
 
-TaskExecutor::TaskExecutor(asio::io_context& context):
-	mContext(context), mDispatcher(context)
+void TaskExecutor::wait(WaitMode mode)
 {
+	if (mode == WM_BLOCK && mDispatcher.hasWorkers())
+	{
+		while (true)
+		{
+			auto count = mTaskCount.load(std::memory_order_acquire);
+			if (count == 0)
+				break;
+			if (runPendingTask())
+				continue;
+			// the rest are running on workers, strand-bound or parked on an awaitable
+			mTaskCount.wait(count, std::memory_order_acquire);
+		}
+		return;
+	}
+
+	while(mTaskCount.load(std::memory_order_acquire) != 0)
+		mDispatcher.poll_one();
 }
 
-void TaskExecutor::wait()
+void TaskExecutor::poll()
 {
-	while(mTaskCount.load(std::memory_order_relaxed) != 0)
-		getContext().poll_one();
+	mDispatcher.poll();
+}
+
+size_t TaskExecutor::getGrainSize(size_t count, size_t grain)const
+{
+	if (grain != 0)
+		return grain;
+	// a few chunks per thread, so that a slow chunk can be balanced by stealing the others
+	auto numChunks = mDispatcher.getConcurrency() * 8;
+	return std::max<size_t>((count + numChunks - 1) / numChunks, 1);
+}
+
+void TaskExecutor::forEachChunk(size_t numChunks, const UniqueFunction<void(size_t)>& body)
+{
+	// shared, the last chunk still notifies after the waiter may have seen the count drop to 0
+	auto context = std::make_shared<ParallelContext>();
+	context->body = &body;
+	context->remaining.store(numChunks, std::memory_order_relaxed);
+
+	splitChunks(context, 0, numChunks);
+
+	// help with the halves nobody has picked up yet, then wait for the ones being run
+	while (true)
+	{
+		auto remaining = context->remaining.load(std::memory_order_acquire);
+		if (remaining == 0)
+			break;
+		if (!mDispatcher.hasWorkers())
+			mDispatcher.poll_one();
+		else if (!runPendingTask())
+			context->remaining.wait(remaining, std::memory_order_acquire);
+	}
+}
+
+void TaskExecutor::splitChunks(const std::shared_ptr<ParallelContext>& context, size_t begin, size_t end)
+{
+	// keep the lower half and hand the upper one to whoever is idle
+	while (end - begin > 1)
+	{
+		auto mid = begin + (end - begin) / 2;
+		addTask([this, context, mid, end]() {
+			splitChunks(context, mid, end);
+		}, false);
+		end = mid;
+	}
+
+	(*context->body)(begin);
+
+	// release pairs with the acquire loads in forEachChunk
+	if (context->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		context->remaining.notify_all();
 }
 
 asio::io_context& TaskExecutor::getContext()
@@ -1,15 +1,14 @@
 #pragma once
-#include "Common.h"
 #include "Dispatcher.h"
 #include "Fence.h"
-#include "Thread.h"
 #include "Coroutine.h"
 #include <atomic>
+#include <deque>
 class TaskExecutor
 {
 public:
-	using Future = Future<Promise>;
-	using Coroutine = Coroutine<Promise>;
+	using Future = ::Future<Promise>;
+	using Coroutine = ::Coroutine<Promise>;
 	class Task
 	{
 		friend class TaskExecutor;
@@ -22,69 +21,157 @@ public:
 		{
 		}
 
-		Task(Task&& task):
+		Task(Task&& task) noexcept:
 			mCoroutine(std::move(task.mCoroutine)),
-			mMove(std::move(task.mMove)),
-			mDone(std::move(task.mDone))
+			mExecutor(task.mExecutor),
+			mStrand(task.mStrand),
+			mContinuation(std::move(task.mContinuation))
 		{
-			task.mMove = {};
-			task.mDone = {};
 		}
 
-		Task(const Task& t) 
-		{
-
-		}
-		void operator()()
-		{
-			if (mCoroutine.isValid())
-				mCoroutine.resume();
-			else
-				return;
-			if (!mCoroutine.done())
-				mMove(std::move(*this));
-			else
-				mDone();
-		}
+		void operator()();
 	private:
 		Coroutine mCoroutine;
-		std::function<void(Task&&)> mMove;
-		std::function<void()> mDone;
+		TaskExecutor* mExecutor = nullptr;
+		bool mStrand = false;
+		// kept behind a pointer so that tasks without one stay small enough for inline storage
+		std::unique_ptr<UniqueFunction<void()>> mContinuation;
 	};
 
 
 	using Ptr = std::shared_ptr<TaskExecutor>;
 
-	TaskExecutor(asio::io_context& context);
-	void addTask(std::function<void()>&& task, bool strand);
+	// every task of the executor runs in the dispatcher lane of priority
+	TaskExecutor(asio::io_context& context, DispatchPriority priority = DP_NORMAL);
+	// tasks that never started are dropped, call wait() first to run them
+	~TaskExecutor();
+	void addTask(UniqueFunction<void()>&& task, bool strand);
 
 	template<class F, class ... Args>
 	void addCoroutineTask(F&& task,bool strand, Args&& ... args)
 	{
-		mTaskCount.fetch_add(1, std::memory_order_relaxed);
+		pushCoroutineTask(std::move(task), strand, {}, std::forward<Args>(args)...);
+	}
 
-		Task t(std::move(task), std::forward<Args>(args)...);
-		t.mMove = [=](Task&& t)
-		{
-			addTask(std::move(t),strand);
-		};
-		t.mDone = [=]() 
-		{
-			mTaskCount.fetch_sub(1, std::memory_order_relaxed);
-		};
+	// continuation runs on the thread that finishes the coroutine, before the task stops counting for wait()
+	template<class F, class ... Args>
+	void addCoroutineTaskThen(F&& task, UniqueFunction<void()>&& continuation, bool strand, Args&& ... args)
+	{
+		pushCoroutineTask(std::move(task), strand, std::move(continuation), std::forward<Args>(args)...);
+	}
 
-		addTask(std::move(t), strand);
+	// same as addCoroutineTask, the returned flag is set when the task finishes and can be co_awaited
+	template<class F, class ... Args>
+	AwaitableFlag::Ptr addAwaitableTask(F&& task, bool strand, Args&& ... args)
+	{
+		auto completion = std::make_shared<AwaitableFlag>();
+		pushCoroutineTask(std::move(task), strand, [completion]() {
+			completion->set();
+		}, std::forward<Args>(args)...);
+		return completion;
 	}
 	void addTask(Task&& task, bool strand);
 	
 
-	void wait();
+	enum WaitMode
+	{
+		// runs any ready handler of the dispatcher until all tasks are done
+		WM_POLL,
+		// runs only this executor's queued tasks, then sleeps until the rest are done.
+		// falls back to WM_POLL when the dispatcher has no worker threads.
+		WM_BLOCK,
+	};
+
+	void wait(WaitMode mode = WM_POLL);
+	void poll();
+
+	// calls fn(i) for every i in [begin, end) and returns when all calls are done.
+	// grain is the number of indices run by one task, 0 picks one from the concurrency of the dispatcher.
+	template<class F>
+	void parallel_for(size_t begin, size_t end, size_t grain, const F& fn)
+	{
+		if (begin >= end)
+			return;
+		grain = getGrainSize(end - begin, grain);
+		forEachChunk((end - begin + grain - 1) / grain, [&](size_t chunk) {
+			auto first = begin + chunk * grain;
+			auto last = std::min(first + grain, end);
+			for (auto i = first; i < last; ++i)
+				fn(i);
+		});
+	}
+
+	// folds join(acc, map(i)) over [begin, end), every chunk starts from identity.
+	// partial results are joined in index order, so the result does not depend on scheduling.
+	template<class T, class Map, class Join>
+	T parallel_reduce(size_t begin, size_t end, size_t grain, const T& identity, const Map& map, const Join& join)
+	{
+		if (begin >= end)
+			return identity;
+		grain = getGrainSize(end - begin, grain);
+		auto numChunks = (end - begin + grain - 1) / grain;
+		std::vector<T> partials(numChunks, identity);
+		forEachChunk(numChunks, [&](size_t chunk) {
+			auto first = begin + chunk * grain;
+			auto last = std::min(first + grain, end);
+			T acc = identity;
+			for (auto i = first; i < last; ++i)
+				acc = join(acc, map(i));
+			partials[chunk] = std::move(acc);
+		});
+
+		T result = identity;
+		for (auto& p : partials)
+			result = join(result, p);
+		return result;
+	}
 
 	asio::io_context& getContext();
 private:
+	template<class F, class ... Args>
+	void pushCoroutineTask(F&& task, bool strand, UniqueFunction<void()>&& continuation, Args&& ... args)
+	{
+		mTaskCount.fetch_add(1, std::memory_order_relaxed);
+
+		Task t(std::move(task), std::forward<Args>(args)...);
+		t.mExecutor = this;
+		t.mStrand = strand;
+		if (continuation)
+			t.mContinuation = std::make_unique<UniqueFunction<void()>>(std::move(continuation));
+
+		addTask(std::move(t), strand);
+	}
+	void finishTask(Task& task);
+	bool runPendingTask();
+
+	struct PendingTasks
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		// only ever taken by the strand runners, wait() would break their serial order
+		std::deque<Task> strandTasks;
+	};
+	static bool runPendingTask(PendingTasks& pending);
+	static bool runPendingStrandTask(PendingTasks& pending);
+
+	struct ParallelContext
+	{
+		const UniqueFunction<void(size_t)>* body;
+		std::atomic<size_t> remaining;
+	};
+	size_t getGrainSize(size_t count, size_t grain)const;
+	void forEachChunk(size_t numChunks, const UniqueFunction<void(size_t)>& body);
+	void splitChunks(const std::shared_ptr<ParallelContext>& context, size_t begin, size_t end);
+
 	asio::io_context& mContext;
 	Dispatcher mDispatcher;
 	FenceObject mComplete;
 	std::atomic_int mTaskCount = 0;
 
+	// tasks wait here so that wait() can pick up its own non-strand work,
+	// every queued task has a matching runner posted to the dispatcher or its strand.
+	// the runners share it, one whose task was taken by wait() or dropped by the destructor
+	// may run after the executor is gone
+	std::shared_ptr<PendingTasks> mPending = std::make_shared<PendingTasks>();
+
 };
\ No newline at end of file
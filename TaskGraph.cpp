@@ -0,0 +1,144 @@
+#include "TaskGraph.h"
+#include <cassert>
+
+TaskGraph::TaskGraph(TaskExecutor& executor):
+	mExecutor(executor)
+{
+}
+
+TaskGraph::~TaskGraph()
+{
+	assert((!mExecuting || isDone()) && "task graph is destroyed while running");
+}
+
+TaskGraph::Node TaskGraph::addTask(UniqueFunction<void()>&& task, const std::vector<Node>& predecessors, bool strand)
+{
+	auto node = new NodeData;
+	node->task = std::move(task);
+	node->strand = strand;
+	return addNode(node, predecessors);
+}
+
+TaskGraph::Node TaskGraph::addCoroutineTask(CoroutineTask&& task, const std::vector<Node>& predecessors, bool strand)
+{
+	auto node = new NodeData;
+	node->coroutine = std::move(task);
+	node->strand = strand;
+	return addNode(node, predecessors);
+}
+
+TaskGraph::Node TaskGraph::addNode(NodeData* node, const std::vector<Node>& predecessors)
+{
+	assert(!mExecuting && "cannot add tasks to a running graph");
+	Node index = mNodes.size();
+	mNodes.emplace_back(node);
+
+	for (auto pred : predecessors)
+	{
+		assert(pred < index && "predecessor must be added before its successors");
+		auto& successors = mNodes[pred]->successors;
+		if (std::find(successors.begin(), successors.end(), index) != successors.end())
+			continue;
+		successors.push_back(index);
+		node->numPredecessors++;
+	}
+	return index;
+}
+
+void TaskGraph::addContinuation(Node node, UniqueFunction<void()>&& continuation)
+{
+	assert(!mExecuting && "cannot add continuations to a running graph");
+	assert(node < mNodes.size() && "invalid node");
+	mNodes[node]->continuations.push_back(std::move(continuation));
+}
+
+void TaskGraph::execute()
+{
+	assert(!mExecuting && "task graph is already running");
+	mExecuting = true;
+	mCompletion.reset();
+	if (mNodes.empty())
+	{
+		mCompletion.set();
+		return;
+	}
+
+	mRemaining.store(mNodes.size(), std::memory_order_relaxed);
+	for (auto& node : mNodes)
+		node->pending.store(node->numPredecessors, std::memory_order_relaxed);
+
+	// collect the roots first, a launched root may already release other nodes
+	std::vector<Node> roots;
+	for (Node i = 0; i < mNodes.size(); ++i)
+	{
+		if (mNodes[i]->numPredecessors == 0)
+			roots.push_back(i);
+	}
+	for (auto root : roots)
+		launch(root);
+}
+
+void TaskGraph::launch(Node index)
+{
+	auto node = mNodes[index].get();
+	auto then = [this, index]() {
+		finish(index);
+	};
+
+	if (node->coroutine)
+	{
+		// the callable stays in the node, so captures remain valid across suspensions
+		mExecutor.addCoroutineTaskThen(node->coroutine, std::move(then), node->strand);
+	}
+	else
+	{
+		mExecutor.addCoroutineTaskThen([](NodeData* node)->TaskExecutor::Future
+		{
+			co_await std::suspend_always();
+			node->task();
+			co_return;
+		}, std::move(then), node->strand, node);
+	}
+}
+
+void TaskGraph::finish(Node index)
+{
+	auto node = mNodes[index].get();
+	for (auto& continuation : node->continuations)
+		continuation();
+
+	// acq_rel so the successor sees what all of its predecessors wrote
+	for (auto succ : node->successors)
+	{
+		if (mNodes[succ]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			launch(succ);
+	}
+
+	if (mRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		mCompletion.set();
+}
+
+void TaskGraph::wait(TaskExecutor::WaitMode mode)
+{
+	if (!mExecuting)
+		return;
+	mExecutor.wait(mode);
+}
+
+bool TaskGraph::isDone()const
+{
+	return mCompletion.isSet();
+}
+
+AwaitableFlag& TaskGraph::getCompletion()
+{
+	return mCompletion;
+}
+
+void TaskGraph::reset()
+{
+	assert((!mExecuting || isDone()) && "cannot reset a running graph");
+	mNodes.clear();
+	mExecuting = false;
+	mCompletion.reset();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "TaskExecutor.h"
+#include <atomic>
+#include <vector>
+
+// dependency graph on top of TaskExecutor.
+// every node names its predecessors when it is added, so the graph is acyclic by construction.
+// a node is scheduled by whichever predecessor finishes last, no thread waits for it.
+class TaskGraph
+{
+public:
+	using Ptr = std::shared_ptr<TaskGraph>;
+	using Node = size_t;
+	using CoroutineTask = UniqueFunction<TaskExecutor::Future()>;
+
+	TaskGraph(TaskExecutor& executor);
+	~TaskGraph();
+
+	Node addTask(UniqueFunction<void()>&& task, const std::vector<Node>& predecessors = {}, bool strand = false);
+	// the node finishes when the coroutine returns, not when it first suspends
+	Node addCoroutineTask(CoroutineTask&& task, const std::vector<Node>& predecessors = {}, bool strand = false);
+	// runs after the node finishes and before its successors are scheduled
+	void addContinuation(Node node, UniqueFunction<void()>&& continuation);
+
+	// schedules the nodes without predecessors, nothing can be added afterwards
+	void execute();
+	// waits for every task of the executor, not only the ones of this graph
+	void wait(TaskExecutor::WaitMode mode = TaskExecutor::WM_POLL);
+	bool isDone()const;
+	// set when the last node finishes, can be co_awaited
+	AwaitableFlag& getCompletion();
+
+	// drops all nodes so the graph can be built again, must not be running
+	void reset();
+
+	size_t getNumNodes()const { return mNodes.size(); }
+private:
+	struct NodeData
+	{
+		UniqueFunction<void()> task;
+		CoroutineTask coroutine;
+		std::vector<UniqueFunction<void()>> continuations;
+		std::vector<Node> successors;
+		size_t numPredecessors = 0;
+		std::atomic<size_t> pending = 0;
+		bool strand = false;
+	};
+
+	Node addNode(NodeData* node, const std::vector<Node>& predecessors);
+	void launch(Node node);
+	void finish(Node node);
+
+	TaskExecutor& mExecutor;
+	std::vector<std::unique_ptr<NodeData>> mNodes;
+	std::atomic<size_t> mRemaining = 0;
+	AwaitableFlag mCompletion;
+	bool mExecuting = false;
+};
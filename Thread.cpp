@@ -1,4 +1,5 @@
 #include "Thread.h"
+#include "ThreadTopology.h"
 
 thread_local Thread* Thread::CurrentThread = nullptr;
 
@@ -24,13 +25,15 @@ bool Thread::isMainThread()
 	return getId() == 0;
 }
 
-Thread::Thread(const std::string& name, size_t id, std::function<void()>&& f):
+Thread::Thread(const std::string& name, size_t id, std::function<void()>&& f, const std::vector<size_t>& affinity):
 	mName(name)
 {
 	mID = id;
 
-	mThread = std::make_shared<std::thread>([curthread = this, func = std::move(f)](){
+	mThread = std::make_shared<std::thread>([curthread = this, func = std::move(f), affinity](){
 		Thread::CurrentThread = curthread;
+		if (!affinity.empty() && !ThreadTopology::pinCurrentThread(affinity))
+			LOG("fail to pin thread " + curthread->getName());
 		func();
 	});
 }
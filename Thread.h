@@ -10,7 +10,8 @@ public:
 	static std::string getCurrentName();
 	static size_t getId();
 	static bool isMainThread();
-	Thread(const std::string& name, size_t id, std::function<void()>&& f);
+	// affinity is a list of logical processors the thread is pinned to before f runs, empty to leave it unpinned
+	Thread(const std::string& name, size_t id, std::function<void()>&& f, const std::vector<size_t>& affinity = {});
 	~Thread();
 	void join();
 
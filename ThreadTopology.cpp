@@ -0,0 +1,318 @@
+#include "ThreadTopology.h"
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ThreadTopology ThreadTopology::Singleton;
+
+namespace
+{
+	bool readLine(const std::string& path, std::string& line)
+	{
+		std::ifstream file(path);
+		if (!file)
+			return false;
+		std::getline(file, line);
+		return true;
+	}
+
+	bool readNumber(const std::string& path, size_t& value)
+	{
+		std::string line;
+		if (!readLine(path, line) || line.empty())
+			return false;
+		value = std::stoull(line);
+		return true;
+	}
+
+	// sysfs cpu list, e.g. "0-3,8,10-11"
+	std::vector<size_t> parseList(const std::string& list)
+	{
+		std::vector<size_t> ret;
+		std::stringstream ss(list);
+		std::string range;
+		while (std::getline(ss, range, ','))
+		{
+			if (range.empty() || !isdigit((unsigned char)range[0]))
+				continue;
+			auto dash = range.find('-');
+			size_t first = std::stoull(range.substr(0, dash));
+			size_t last = dash == std::string::npos ? first : std::stoull(range.substr(dash + 1));
+			for (auto i = first; i <= last; ++i)
+				ret.push_back(i);
+		}
+		return ret;
+	}
+}
+
+ThreadTopology::ThreadTopology()
+{
+	detect();
+}
+
+#ifdef _WIN32
+void ThreadTopology::detect()
+{
+	DWORD length = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+	std::vector<char> buffer(length);
+	if (length == 0 || !GetLogicalProcessorInformationEx(RelationProcessorCore, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)buffer.data(), &length))
+	{
+		detectFallback();
+		return;
+	}
+
+	for (DWORD offset = 0; offset < length;)
+	{
+		auto info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer.data() + offset);
+		offset += info->Size;
+
+		Core core;
+		core.efficiency = info->Processor.EfficiencyClass;
+		for (WORD g = 0; g < info->Processor.GroupCount; ++g)
+		{
+			auto& affinity = info->Processor.GroupMask[g];
+			for (size_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+			{
+				if (affinity.Mask & ((KAFFINITY)1 << bit))
+					core.processors.push_back(affinity.Group * sizeof(KAFFINITY) * 8 + bit);
+			}
+		}
+		if (!core.processors.empty())
+			mCores.push_back(std::move(core));
+	}
+
+	if (mCores.empty())
+		detectFallback();
+	sortCores();
+}
+
+bool ThreadTopology::pinCurrentThread(const std::vector<size_t>& processors)
+{
+	const size_t bits = sizeof(KAFFINITY) * 8;
+	GROUP_AFFINITY affinity = {};
+	if (processors.empty())
+	{
+		DWORD_PTR process, system;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+			return false;
+		return SetThreadAffinityMask(GetCurrentThread(), process) != 0;
+	}
+
+	// a thread can only be pinned inside one processor group
+	affinity.Group = (WORD)(processors[0] / bits);
+	for (auto p : processors)
+	{
+		if (p / bits == affinity.Group)
+			affinity.Mask |= (KAFFINITY)1 << (p % bits);
+	}
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+#else
+void ThreadTopology::detect()
+{
+	if (!detectFromSysfs("/sys/devices/system/cpu"))
+		detectFallback();
+}
+
+bool ThreadTopology::pinCurrentThread(const std::vector<size_t>& processors)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (processors.empty())
+	{
+		for (size_t i = 0; i < CPU_SETSIZE; ++i)
+			CPU_SET(i, &set);
+	}
+	for (auto p : processors)
+	{
+		if (p < CPU_SETSIZE)
+			CPU_SET(p, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#endif
+
+bool ThreadTopology::detectFromSysfs(const std::string& root)
+{
+	std::string online;
+	if (!readLine(root + "/online", online))
+		return false;
+	auto processors = parseList(online);
+	if (processors.empty())
+		return false;
+
+	// intel hybrid parts list their performance and efficiency cores separately
+	std::vector<size_t> atoms;
+	std::string line;
+	if (readLine(root + "/../../cpu_atom/cpus", line))
+		atoms = parseList(line);
+
+	std::vector<Core> cores;
+	std::map<std::pair<size_t, size_t>, size_t> indices;
+	for (auto p : processors)
+	{
+		auto dir = root + "/cpu" + std::to_string(p);
+		size_t id = p;
+		size_t package = 0;
+		readNumber(dir + "/topology/core_id", id);
+		readNumber(dir + "/topology/physical_package_id", package);
+
+		size_t efficiency = 0;
+		if (!atoms.empty())
+			efficiency = std::find(atoms.begin(), atoms.end(), p) == atoms.end() ? 1 : 0;
+		else
+			readNumber(dir + "/cpu_capacity", efficiency);
+
+		auto ret = indices.emplace(std::make_pair(package, id), cores.size());
+		if (ret.second)
+		{
+			cores.push_back({});
+			cores.back().package = package;
+		}
+		auto& core = cores[ret.first->second];
+		core.efficiency = std::max(core.efficiency, efficiency);
+		core.processors.push_back(p);
+	}
+
+	mCores = std::move(cores);
+	sortCores();
+	return true;
+}
+
+void ThreadTopology::detectFallback()
+{
+	mCores.clear();
+	auto count = std::max(std::thread::hardware_concurrency(), 1u);
+	for (size_t i = 0; i < count; ++i)
+	{
+		Core core;
+		core.processors.push_back(i);
+		mCores.push_back(std::move(core));
+	}
+}
+
+void ThreadTopology::sortCores()
+{
+	std::stable_sort(mCores.begin(), mCores.end(), [](const Core& a, const Core& b) {
+		if (a.efficiency != b.efficiency)
+			return a.efficiency > b.efficiency;
+		if (a.package != b.package)
+			return a.package < b.package;
+		return a.processors.front() < b.processors.front();
+	});
+}
+
+size_t ThreadTopology::getNumProcessors() const
+{
+	size_t count = 0;
+	for (auto& c : mCores)
+		count += c.processors.size();
+	return count;
+}
+
+ThreadTopology::Layout ThreadTopology::plan(PinPolicy policy, size_t maxWorkers, bool isolateMain) const
+{
+	Layout layout;
+	layout.policy = policy;
+	layout.isolateMain = isolateMain;
+
+	WorkerGroup main = { "main" };
+	WorkerGroup workers = { "worker" };
+
+	size_t first = 0;
+	if (policy != PP_NONE && isolateMain && !mCores.empty())
+	{
+		main.threads.push_back(mCores[0].processors);
+		first = 1;
+	}
+	else
+		main.threads.push_back({});
+
+	switch (policy)
+	{
+	case PP_NONE:
+		for (size_t i = 1; i < getNumProcessors(); ++i)
+			workers.threads.push_back({});
+		break;
+	case PP_PHYSICAL_CORES:
+		for (auto i = first; i < mCores.size(); ++i)
+			workers.threads.push_back(mCores[i].processors);
+		break;
+	case PP_LOGICAL_PROCESSORS:
+		for (auto i = first; i < mCores.size(); ++i)
+		{
+			for (auto p : mCores[i].processors)
+				workers.threads.push_back({ p });
+		}
+		break;
+	}
+
+	if (workers.threads.size() > maxWorkers)
+		workers.threads.resize(maxWorkers);
+
+	layout.groups.push_back(std::move(main));
+	layout.groups.push_back(std::move(workers));
+	return layout;
+}
+
+void ThreadTopology::apply(const Layout& layout)
+{
+	mLayout = layout;
+	mDescription = toString() + ", " + mLayout.toString();
+	if (auto main = mLayout.findGroup("main"))
+	{
+		if (!main->threads.empty() && !main->threads[0].empty() && !pinCurrentThread(main->threads[0]))
+			LOG("fail to pin main thread");
+	}
+}
+
+std::string ThreadTopology::toString() const
+{
+	std::set<size_t> packages;
+	std::set<size_t> classes;
+	for (auto& c : mCores)
+	{
+		packages.insert(c.package);
+		classes.insert(c.efficiency);
+	}
+	std::stringstream ss;
+	ss << mCores.size() << " cores, " << getNumProcessors() << " threads, " << packages.size() << " packages";
+	if (classes.size() > 1)
+		ss << ", hybrid";
+	return ss.str();
+}
+
+const ThreadTopology::WorkerGroup* ThreadTopology::Layout::findGroup(const std::string& name) const
+{
+	for (auto& g : groups)
+	{
+		if (g.name == name)
+			return &g;
+	}
+	return nullptr;
+}
+
+std::string ThreadTopology::Layout::toString() const
+{
+	static const char* policies[] = { "none", "physical cores", "logical processors" };
+
+	std::stringstream ss;
+	ss << policies[policy];
+	for (auto& g : groups)
+	{
+		ss << " | " << g.name << " x" << g.threads.size() << ":";
+		for (auto& t : g.threads)
+		{
+			ss << " ";
+			if (t.empty())
+				ss << "*";
+			for (size_t i = 0; i < t.size(); ++i)
+				ss << (i ? "," : "") << t[i];
+		}
+	}
+	return ss.str();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Common.h"
+
+// logical processors grouped into physical cores, and the worker layout derived from them.
+// detected with GetLogicalProcessorInformationEx on windows and from sysfs on linux.
+class ThreadTopology
+{
+public:
+	struct Core
+	{
+		size_t package = 0;
+		// higher is faster, differs only on hybrid cpus
+		size_t efficiency = 0;
+		// logical processors, more than one with SMT
+		std::vector<size_t> processors;
+	};
+
+	enum PinPolicy
+	{
+		// no affinity, one worker per logical processor except the main thread's
+		PP_NONE,
+		// one worker per physical core, pinned to all siblings of that core, fastest cores first
+		PP_PHYSICAL_CORES,
+		// one worker per logical processor
+		PP_LOGICAL_PROCESSORS,
+	};
+
+	struct WorkerGroup
+	{
+		std::string name;
+		// affinity of every thread of the group, empty means not pinned
+		std::vector<std::vector<size_t>> threads;
+	};
+
+	struct Layout
+	{
+		PinPolicy policy = PP_NONE;
+		// the main thread gets a core of its own that no worker is pinned to
+		bool isolateMain = true;
+		std::vector<WorkerGroup> groups;
+
+		const WorkerGroup* findGroup(const std::string& name)const;
+		std::string toString()const;
+	};
+
+	static ThreadTopology Singleton;
+
+	ThreadTopology();
+	// reads a sysfs tree, e.g. "/sys/devices/system/cpu", returns false if nothing was found
+	bool detectFromSysfs(const std::string& root);
+
+	// puts the main thread in group "main" and up to maxWorkers threads in group "worker"
+	Layout plan(PinPolicy policy, size_t maxWorkers = -1, bool isolateMain = true)const;
+	// pins the calling thread as the main thread of layout and keeps it for reporting
+	void apply(const Layout& layout);
+	const Layout& getLayout()const { return mLayout; }
+	// topology and applied layout in one line
+	const std::string& getDescription()const { return mDescription; }
+
+	const std::vector<Core>& getCores()const { return mCores; }
+	size_t getNumProcessors()const;
+	std::string toString()const;
+
+	// pins the calling thread, an empty list clears the affinity. returns false if the os refused.
+	static bool pinCurrentThread(const std::vector<size_t>& processors);
+private:
+	void detect();
+	void detectFallback();
+	void sortCores();
+
+	std::vector<Core> mCores;
+	Layout mLayout;
+	std::string mDescription;
+};
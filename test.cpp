@@ -31,4 +31,1299 @@ int main()
 	return 0;
 }
 
-#endif
\ No newline at end of file
+#endif
+
+#if defined(_TEST)
+
+// nothing here needs a device, so the tests also run on platforms without d3d12
+#include "HazardValidator.h"
+#include <cstdio>
+
+static int failures = 0;
+#define EXPECT(x) do { if (!(x)) { printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+// frames replayed by hand, one per kind of hazard the validator reports
+void hazardValidatorTest()
+{
+	const auto ALL = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	auto transition = [](HazardValidator& validator, int queue, HazardValidator::View* view, D3D12_RESOURCE_STATES state) {
+		HazardValidator::CommandList cmdlist(validator, queue);
+		cmdlist.transitionBarrier(view, state, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, true);
+	};
+
+	// render, transition, sample
+	{
+		HazardValidator validator;
+		auto rt = validator.addView("rt", RenderTypes::VT_RENDERTARGET);
+		transition(validator, 0, rt, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.clearRenderTarget(rt, {});
+		}
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_RENDER_TARGET, true, "draw");
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_RENDER_TARGET, true, "draw2");
+		transition(validator, 0, rt, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, false, "sample");
+		EXPECT(validator.getErrors().empty());
+	}
+
+	// sampled without the transition
+	{
+		HazardValidator validator;
+		auto rt = validator.addView("rt", RenderTypes::VT_RENDERTARGET);
+		transition(validator, 0, rt, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_RENDER_TARGET, true, "draw");
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, false, "sample");
+		auto& errors = validator.getErrors();
+		EXPECT(errors.size() == 2);
+		EXPECT(errors.size() == 2 && errors[0] == "sample uses rt mip 0 as 0x80, but it is in 0x4");
+		EXPECT(errors.size() == 2 && errors[1] == "read-after-write hazard on rt mip 0: no barrier between draw and sample");
+	}
+
+	// used before any transition of the frame, and barriers left unflushed
+	{
+		HazardValidator validator;
+		auto ua = validator.addView("ua", RenderTypes::VT_UNORDEREDACCESS);
+		validator.access(0, ua, 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true, "simulate");
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.uavBarrier(ua);
+		}
+		auto& errors = validator.getErrors();
+		EXPECT(errors.size() == 2);
+		EXPECT(errors.size() == 2 && errors[0] == "simulate uses ua mip 0 before any transition of the frame");
+		EXPECT(errors.size() == 2 && errors[1] == "1 barriers are recorded but not flushed");
+	}
+
+	// two dispatches writing one unordered access view need a uav barrier between them
+	for (auto barrier : { false, true })
+	{
+		HazardValidator validator;
+		auto ua = validator.addView("ua", RenderTypes::VT_UNORDEREDACCESS);
+		transition(validator, 0, ua, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		validator.access(0, ua, 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true, "simulate");
+		if (barrier)
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.uavBarrier(ua, true);
+		}
+		validator.access(0, ua, 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true, "integrate");
+		auto& errors = validator.getErrors();
+		if (barrier)
+			EXPECT(errors.empty());
+		else
+		{
+			EXPECT(errors.size() == 1);
+			EXPECT(errors.size() == 1 && errors[0] == "write-after-write hazard on ua mip 0: integrate needs a uav barrier after simulate");
+		}
+	}
+
+	// compute writes, graphics reads, ordered only by the fence
+	for (auto fence : { false, true })
+	{
+		HazardValidator validator;
+		auto ua = validator.addView("ua", RenderTypes::VT_UNORDEREDACCESS);
+		transition(validator, 1, ua, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		validator.access(1, ua, 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, true, "simulate");
+		validator.signal(1, 0);
+		if (fence)
+			validator.wait(0, 1, 0);
+		validator.access(0, ua, 0, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, false, "draw");
+		auto& errors = validator.getErrors();
+		if (fence)
+			EXPECT(errors.empty());
+		else
+		{
+			EXPECT(errors.size() == 1);
+			EXPECT(errors.size() == 1 && errors[0] == "read-after-write hazard on ua mip 0: draw on queue 0 does not wait for simulate on queue 1");
+		}
+	}
+
+	// waiting for a point nobody signals
+	{
+		HazardValidator validator;
+		validator.wait(0, 1, 3);
+		auto& errors = validator.getErrors();
+		EXPECT(errors.size() == 1 && errors[0] == "queue 0 waits for point 3 of queue 1, which is not signalled before");
+	}
+
+	// the mip is unusable between the begin and the end of a split transition
+	{
+		HazardValidator validator;
+		auto rt = validator.addView("rt", RenderTypes::VT_RENDERTARGET, 2);
+		transition(validator, 0, rt, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		validator.access(0, rt, 1, D3D12_RESOURCE_STATE_RENDER_TARGET, true, "draw");
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.beginTransition(rt, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+			cmdlist.flushResourceBarrier();
+		}
+		validator.access(0, rt, 1, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, false, "early");
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.endTransition(rt, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+			cmdlist.flushResourceBarrier();
+		}
+		validator.access(0, rt, 1, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, false, "sample");
+		// the other mip is not part of the transition
+		validator.access(0, rt, 0, D3D12_RESOURCE_STATE_RENDER_TARGET, true, "draw2");
+		auto& errors = validator.getErrors();
+		EXPECT(errors.size() == 1);
+		EXPECT(errors.size() == 1 && errors[0] == "early uses rt mip 1 during a split transition");
+	}
+
+	// a transition from the wrong state
+	{
+		HazardValidator validator;
+		auto rt = validator.addView("rt", RenderTypes::VT_RENDERTARGET);
+		transition(validator, 0, rt, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		{
+			HazardValidator::CommandList cmdlist(validator, 0);
+			cmdlist.transition(rt, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, ALL);
+			cmdlist.flushResourceBarrier();
+		}
+		auto& errors = validator.getErrors();
+		EXPECT(errors.size() == 1 && errors[0] == "transition of rt mip 0 from 0x800, but it is in 0x4");
+	}
+}
+
+#include "CommandListRing.h"
+#include "RenderGraph.h"
+#include "TaskExecutor.h"
+#include "TaskGraph.h"
+#include <map>
+#include <random>
+#include <thread>
+
+// workers of the shared scheduler, started the way the framework does for the tests without a window
+class TestWorkers
+{
+public:
+	TestWorkers()
+	{
+		auto count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		Dispatcher::enableWorkStealing(count);
+		mThreads.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			mThreads.emplace_back([i]() {
+				Dispatcher::runWorker(i);
+			});
+		}
+	}
+
+	~TestWorkers()
+	{
+		Dispatcher::stop(Dispatcher::getSharedContext());
+		for (auto& t : mThreads)
+			t.join();
+	}
+private:
+	std::vector<std::thread> mThreads;
+};
+
+// blocking waits that the tasks of other executors have to finish, and executors destroyed right after
+// their wait while the runners of the tasks the wait took over are still queued
+void waitTest()
+{
+	TaskExecutor executor(Dispatcher::getSharedContext());
+	TaskExecutor other(Dispatcher::getSharedContext());
+	for (size_t round = 0; round < 1000; ++round)
+	{
+		std::vector<size_t> values(64, 0);
+		std::atomic<size_t> done = 0;
+		size_t strandCount = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			executor.addTask([&, i]() {
+				values[i] = i + 1;
+				done.fetch_add(1, std::memory_order_relaxed);
+			}, false);
+		}
+		for (size_t i = 0; i < 16; ++i)
+			executor.addTask([&]() { strandCount++; }, true);
+
+		AwaitableFlag flag;
+		executor.addCoroutineTask([](AwaitableFlag* flag, std::atomic<size_t>* done)->TaskExecutor::Future {
+			co_await std::suspend_always();
+			co_await *flag;
+			done->fetch_add(1, std::memory_order_relaxed);
+			co_return;
+		}, false, &flag, &done);
+		other.addTask([&]() { flag.set(); }, false);
+
+		executor.wait(TaskExecutor::WM_BLOCK);
+		size_t missing = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+			missing += values[i] != i + 1;
+		EXPECT(missing == 0);
+		EXPECT(done == values.size() + 1);
+		EXPECT(strandCount == 16);
+		other.wait(TaskExecutor::WM_BLOCK);
+	}
+
+	for (size_t round = 0; round < 1000; ++round)
+	{
+		auto executor = std::make_unique<TaskExecutor>(Dispatcher::getSharedContext());
+		std::atomic<size_t> done = 0;
+		for (size_t i = 0; i < 32; ++i)
+			executor->addTask([&]() { done.fetch_add(1, std::memory_order_relaxed); }, i % 4 == 0);
+		executor->wait(TaskExecutor::WM_BLOCK);
+		executor.reset();
+		EXPECT(done == 32);
+	}
+}
+
+// awaits that start before the first suspend, from a coroutine resumed by hand, and on a fence whose
+// signal wait() already consumed, every coroutine has to be resumed once past each await
+void awaitTest()
+{
+	TaskExecutor executor(Dispatcher::getSharedContext());
+	for (size_t round = 0; round < 200; ++round)
+	{
+		AwaitableFlag flag;
+		FenceObject fence;
+		fence.signal();
+		fence.wait();
+		std::atomic<size_t> resumed = 0;
+
+		executor.addCoroutineTask([](AwaitableFlag* flag, std::atomic<size_t>* resumed)->TaskExecutor::Future {
+			co_await *flag;
+			resumed->fetch_add(1, std::memory_order_relaxed);
+			co_return;
+		}, false, &flag, &resumed);
+
+		TaskExecutor::Coroutine inner([](AwaitableFlag* flag, std::atomic<size_t>* resumed)->TaskExecutor::Future {
+			co_await std::suspend_always();
+			co_await *flag;
+			resumed->fetch_add(1, std::memory_order_relaxed);
+			co_return;
+		}, &flag, &resumed);
+		executor.addCoroutineTask([](TaskExecutor::Coroutine co)->TaskExecutor::Future {
+			co_await std::suspend_always();
+			while (!co.done())
+			{
+				co_await co.yield();
+				co.resume();
+			}
+			co_return;
+		}, true, std::move(inner));
+
+		executor.addCoroutineTask([](FenceObject* fence, std::atomic<size_t>* resumed)->TaskExecutor::Future {
+			co_await std::suspend_always();
+			co_await *fence;
+			resumed->fetch_add(1, std::memory_order_relaxed);
+			co_return;
+		}, false, &fence, &resumed);
+
+		executor.addTask([&]() { flag.set(); }, false);
+		executor.wait(TaskExecutor::WM_BLOCK);
+		EXPECT(resumed == 3);
+	}
+}
+
+// random graphs of plain and coroutine tasks, every node has to run after all of its predecessors
+// and its continuations between the node and its successors
+void taskGraphTest()
+{
+	static const size_t NUM_NODES = 200;
+
+	TaskExecutor executor(Dispatcher::getSharedContext());
+	TaskGraph graph(executor);
+	std::mt19937 rng(1);
+	for (size_t round = 0; round < 200; ++round)
+	{
+		// position of each node in the order the nodes finished, 0 if it did not run
+		std::vector<std::atomic<size_t>> finished(NUM_NODES);
+		std::atomic<size_t> clock = 1;
+		std::vector<std::vector<TaskGraph::Node>> predecessors(NUM_NODES);
+		std::atomic<size_t> continuations = 0;
+		std::atomic<size_t> earlyContinuations = 0;
+		AwaitableFlag gate;
+		for (size_t i = 0; i < NUM_NODES; ++i)
+		{
+			auto count = i == 0 ? 0 : rng() % 4;
+			for (size_t j = 0; j < count; ++j)
+				predecessors[i].push_back(rng() % i);
+
+			TaskGraph::Node node;
+			if (i % 7 == 3)
+			{
+				// finishes when the coroutine returns, the first one waits for a task outside the graph
+				node = graph.addCoroutineTask([&, i]()->TaskExecutor::Future {
+					co_await std::suspend_always();
+					if (i == 3)
+						co_await gate;
+					finished[i] = clock++;
+					co_return;
+				}, predecessors[i], i % 5 == 0);
+			}
+			else
+				node = graph.addTask([&, i]() { finished[i] = clock++; }, predecessors[i], i % 5 == 0);
+
+			if (i % 3 == 0)
+			{
+				graph.addContinuation(node, [&, i]() {
+					earlyContinuations += finished[i] == 0;
+					continuations++;
+				});
+			}
+		}
+
+		graph.execute();
+		executor.addTask([&]() { gate.set(); }, false);
+		graph.wait(TaskExecutor::WM_BLOCK);
+		EXPECT(graph.isDone());
+
+		size_t missing = 0;
+		size_t misordered = 0;
+		for (size_t i = 0; i < NUM_NODES; ++i)
+		{
+			missing += finished[i] == 0;
+			for (auto p : predecessors[i])
+				misordered += finished[p] >= finished[i];
+		}
+		EXPECT(missing == 0);
+		EXPECT(misordered == 0);
+		EXPECT(continuations == (NUM_NODES + 2) / 3);
+		EXPECT(earlyContinuations == 0);
+		graph.reset();
+	}
+
+	// a graph without nodes is done right away
+	graph.execute();
+	EXPECT(graph.isDone());
+	graph.reset();
+}
+
+// a critical job posted behind a flooded background lane runs before the lane drains.
+// counted in jobs, not in time: the workers are held in background jobs until the critical one is
+// queued, so with strict priorities it starts once a worker is done with the job it is in
+void priorityLaneTest()
+{
+	static const size_t JOBS_PER_WORKER = 1000;
+
+	Dispatcher critical(Dispatcher::getSharedContext(), DP_CRITICAL);
+	Dispatcher background(Dispatcher::getSharedContext(), DP_BACKGROUND);
+	auto numJobs = critical.getConcurrency() * JOBS_PER_WORKER;
+
+	for (size_t round = 0; round < 20; ++round)
+	{
+		std::atomic<size_t> done = 0;
+		std::atomic<bool> released = false;
+		for (size_t i = 0; i < numJobs; ++i)
+		{
+			background.invoke([&]() {
+				released.wait(false);
+				done.fetch_add(1);
+			});
+		}
+
+		// background jobs finished before the critical one started
+		std::atomic<size_t> before = numJobs + 1;
+		critical.invoke([&]() {
+			before = done.load();
+		});
+		released = true;
+		released.notify_all();
+
+		while (done.load() < numJobs || before.load() > numJobs)
+			std::this_thread::yield();
+		EXPECT(before < numJobs);
+	}
+}
+
+// stands in for a command list, records which ticket it was used for
+struct TestCommandList
+{
+	std::atomic<size_t> users = 0;
+	size_t ticket = -1;
+};
+
+// threads acquire, record and publish out of order, consume() has to see every list once and in ticket order
+void commandListRingTest()
+{
+	CommandListRing<TestCommandList> ring(8, [](size_t) {
+		return new TestCommandList;
+	});
+	std::mt19937 rng(3);
+	for (size_t frame = 0; frame < 1000; ++frame)
+	{
+		size_t numLists = 1 + rng() % 300;
+		size_t numThreads = 1 + rng() % 8;
+		// the first half is acquired by the render thread in graph order, the rest by the recording threads
+		std::vector<CommandListRing<TestCommandList>::Slot> slots(numLists);
+		auto numOrdered = numLists / 2;
+		for (size_t i = 0; i < numOrdered; ++i)
+			slots[i] = ring.acquire();
+
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> shared = 0;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < numThreads; ++t)
+		{
+			threads.emplace_back([&]() {
+				for (auto i = next++; i < numLists; i = next++)
+				{
+					if (i >= numOrdered)
+						slots[i] = ring.acquire();
+					auto& slot = slots[i];
+					shared += slot.item->users++ != 0;
+					slot.item->ticket = slot.ticket;
+					std::this_thread::yield();
+					ring.publish(slot);
+				}
+			});
+		}
+		for (auto& t : threads)
+			t.join();
+
+		size_t misordered = 0;
+		for (size_t i = 0; i < numOrdered; ++i)
+			misordered += slots[i].ticket != i;
+		size_t expected = 0;
+		auto count = ring.consume([&](TestCommandList* list) {
+			misordered += list->ticket != expected++;
+			list->users = 0;
+		});
+		EXPECT(shared == 0);
+		EXPECT(misordered == 0);
+		EXPECT(count == numLists);
+		EXPECT(expected == numLists);
+	}
+	// lists are only created while none is free
+	EXPECT(ring.getNumItems() <= 300);
+}
+
+// handles without views, compile() only looks at their descriptions
+static ResourceHandle::Ptr createTestHandle(Renderer::ViewType type = Renderer::VT_RENDERTARGET, bool imported = false)
+{
+	auto format = type == Renderer::VT_DEPTHSTENCIL ? DXGI_FORMAT_D24_UNORM_S8_UINT : DXGI_FORMAT_R8G8B8A8_UNORM;
+	auto handle = ResourceHandle::create(type, 64, 64, format, {});
+	handle->setImported(imported);
+	return handle;
+}
+
+// the dependency graph, the culling and the levels of compile(), without a device
+void renderGraphCompileTest()
+{
+	using Builder = RenderGraph::Builder;
+	using Passes = std::vector<size_t>;
+
+	// a frame: the debug view is never read, present only reads and the history is imported
+	{
+		auto shadow = createTestHandle(Renderer::VT_DEPTHSTENCIL);
+		auto color = createTestHandle();
+		auto depth = createTestHandle(Renderer::VT_DEPTHSTENCIL);
+		auto debug = createTestHandle();
+		auto lit = createTestHandle();
+		auto history = createTestHandle(Renderer::VT_RENDERTARGET, true);
+
+		RenderGraph graph;
+		graph.addPass("shadow", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.write(shadow, Builder::IT_CLEAR);
+			return {};
+		});
+		graph.addPass("gbuffer", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.write(color, Builder::IT_CLEAR);
+			builder.write(depth, Builder::IT_CLEAR);
+			return {};
+		});
+		graph.addPass("debug", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(depth);
+			builder.write(debug, Builder::IT_CLEAR);
+			return {};
+		});
+		graph.addPass("light", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(shadow);
+			builder.read(color);
+			builder.write(lit, Builder::IT_CLEAR);
+			return {};
+		});
+		graph.addPass("history", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(lit);
+			builder.write(history, Builder::IT_NONE);
+			return {};
+		});
+		graph.addPass("present", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(lit);
+			return {};
+		});
+
+		auto& compiled = graph.compile(false);
+		EXPECT(compiled.numCulled == 1);
+		EXPECT(compiled.nodes[2].culled);
+		std::vector<Passes> levels = { { 0, 1 }, { 3 }, { 4, 5 } };
+		EXPECT(compiled.levels == levels);
+		Passes order = { 0, 1, 3, 4, 5 };
+		EXPECT(compiled.order == order);
+
+		auto light = compiled.nodes[3].predecessors;
+		std::sort(light.begin(), light.end());
+		EXPECT(light == Passes({ 0, 1 }));
+		EXPECT(compiled.nodes[4].predecessors == Passes({ 3 }));
+		EXPECT(compiled.nodes[5].predecessors == Passes({ 3 }));
+		EXPECT(compiled.nodes[4].level == 2);
+		graph.reset();
+	}
+
+	// a chain of passes nobody consumes is culled as a whole, a write has to wait for the reads before it
+	{
+		auto a = createTestHandle();
+		auto b = createTestHandle();
+		auto output = createTestHandle(Renderer::VT_RENDERTARGET, true);
+
+		RenderGraph graph;
+		graph.addPass("first", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.write(a, Builder::IT_CLEAR);
+			return {};
+		});
+		graph.addPass("second", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(a);
+			builder.write(b, Builder::IT_DISCARD);
+			return {};
+		});
+		graph.addPass("read", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.read(output);
+			return {};
+		});
+		graph.addPass("overwrite", [&](Builder& builder)->RenderGraph::RenderTask {
+			builder.write(output, Builder::IT_NONE);
+			return {};
+		});
+
+		auto& compiled = graph.compile(false);
+		EXPECT(compiled.numCulled == 2);
+		EXPECT(compiled.nodes[0].culled && compiled.nodes[1].culled);
+		EXPECT(!compiled.nodes[2].culled && !compiled.nodes[3].culled);
+		EXPECT(compiled.nodes[3].predecessors == Passes({ 2 }));
+		EXPECT(compiled.nodes[3].level == 1);
+		EXPECT(compiled.order == Passes({ 2, 3 }));
+		graph.reset();
+	}
+}
+
+// the barriers compile() plans per level: one batch per level, split transitions over idle levels,
+// nothing for reads in the state of the previous level, and a plan the hazard validator accepts
+void barrierPlanTest()
+{
+	using Builder = RenderGraph::Builder;
+	using CompiledGraph = RenderGraph::CompiledGraph;
+
+	auto shadow = createTestHandle(Renderer::VT_DEPTHSTENCIL);
+	auto color = createTestHandle();
+	auto ao = createTestHandle();
+	auto lit = createTestHandle();
+
+	RenderGraph graph;
+	// level 0
+	graph.addPass("shadow", [&](Builder& builder)->RenderGraph::RenderTask {
+		builder.write(shadow, Builder::IT_CLEAR);
+		return {};
+	});
+	graph.addPass("gbuffer", [&](Builder& builder)->RenderGraph::RenderTask {
+		builder.write(color, Builder::IT_CLEAR);
+		return {};
+	});
+	// level 1, the shadow map is idle
+	graph.addPass("ao", [&](Builder& builder)->RenderGraph::RenderTask {
+		builder.read(color);
+		builder.write(ao, Builder::IT_CLEAR);
+		return {};
+	});
+	// level 2
+	graph.addPass("light", [&](Builder& builder)->RenderGraph::RenderTask {
+		builder.read(shadow);
+		builder.read(color);
+		builder.read(ao);
+		builder.write(lit, Builder::IT_CLEAR);
+		return {};
+	});
+	// level 3
+	graph.addPass("present", [&](Builder& builder)->RenderGraph::RenderTask {
+		builder.read(lit);
+		return {};
+	});
+
+	auto& compiled = graph.compile(false);
+	auto& batches = compiled.batches[RenderGraph::QA_GRAPHICS];
+	EXPECT(compiled.levels.size() == 4);
+	EXPECT(batches.size() == compiled.levels.size());
+	if (batches.size() != 4)
+		return;
+
+	auto find = [&](size_t level, CompiledGraph::BarrierType type, const ResourceHandle::Ptr& handle)->const CompiledGraph::Barrier* {
+		for (auto& b : batches[level].barriers)
+		{
+			if (b.type == type && compiled.lifetimes[b.resource].handle == handle)
+				return &b;
+		}
+		return nullptr;
+	};
+	auto count = [&](const ResourceHandle::Ptr& handle) {
+		size_t n = 0;
+		for (auto& batch : batches)
+		{
+			for (auto& b : batch.barriers)
+				n += compiled.lifetimes[b.resource].handle == handle;
+		}
+		return n;
+	};
+
+	// the first use of every handle starts from the state recorded in its resource
+	EXPECT(find(0, CompiledGraph::BT_TRACKED, shadow) && find(0, CompiledGraph::BT_TRACKED, color));
+
+	// the shadow map starts its transition right after its writer and ends it before the reader
+	auto begin = find(1, CompiledGraph::BT_BEGIN, shadow);
+	auto end = find(2, CompiledGraph::BT_END, shadow);
+	EXPECT(begin && end);
+	if (begin && end)
+	{
+		EXPECT(begin->before == D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		EXPECT(begin->before == end->before && begin->after == end->after);
+	}
+	EXPECT(count(shadow) == 3);
+	EXPECT(compiled.numSplit == 1);
+
+	// the reads of level 1 and 2 share one transition of the color buffer
+	auto transition = find(1, CompiledGraph::BT_TRANSITION, color);
+	EXPECT(transition && transition->before == D3D12_RESOURCE_STATE_RENDER_TARGET);
+	EXPECT(count(color) == 2);
+	EXPECT(compiled.numRedundant == 1);
+
+	// everything level 2 needs is in its one batch
+	EXPECT(find(2, CompiledGraph::BT_TRANSITION, ao) && find(2, CompiledGraph::BT_TRACKED, lit));
+	EXPECT(batches[2].barriers.size() == 3);
+
+	auto errors = graph.validate(false);
+	EXPECT(errors.empty());
+	graph.reset();
+}
+
+// parallel setups finish in any order, the graph compiled from their builders has to be the one of serial setups
+void parallelSetupTest()
+{
+	using Builder = RenderGraph::Builder;
+	static const size_t NUM_PASSES = 200;
+
+	// the imported ones keep their writers and everything those read from alive
+	std::vector<ResourceHandle::Ptr> handles;
+	for (size_t i = 0; i < 16; ++i)
+		handles.push_back(createTestHandle(Renderer::VT_RENDERTARGET, i % 8 == 0));
+
+	RenderGraph graph;
+	std::atomic<size_t> numSetups = 0;
+	auto compile = [&](bool parallel) {
+		graph.setParallelSetup(parallel);
+		for (size_t i = 0; i < NUM_PASSES; ++i)
+		{
+			graph.addPass("pass " + std::to_string(i), [&, i](Builder& builder)->RenderGraph::RenderTask {
+				// uneven costs, so that the setups do not finish in insertion order
+				size_t work = i;
+				for (size_t n = 0; n < (i % 7) * 1000; ++n)
+					work = work * 31 + n;
+				builder.read(handles[(i + handles.size() - 1 - work % 3) % handles.size()]);
+				builder.write(handles[i % handles.size()], i % 3 == 0 ? Builder::IT_CLEAR : Builder::IT_NONE);
+				numSetups.fetch_add(1, std::memory_order_relaxed);
+				return {};
+			});
+		}
+		auto compiled = graph.compile(false);
+		graph.reset();
+		return compiled;
+	};
+
+	auto serial = compile(false);
+	size_t mismatches = 0;
+	for (size_t round = 0; round < 20; ++round)
+	{
+		auto parallel = compile(true);
+		mismatches += parallel.structureHash != serial.structureHash;
+		mismatches += parallel.order != serial.order || parallel.levels != serial.levels || parallel.numCulled != serial.numCulled;
+		mismatches += parallel.lifetimes.size() != serial.lifetimes.size();
+		for (size_t i = 0; i < std::min(parallel.lifetimes.size(), serial.lifetimes.size()); ++i)
+			mismatches += parallel.lifetimes[i].handle != serial.lifetimes[i].handle;
+		auto& batches = parallel.batches[RenderGraph::QA_GRAPHICS];
+		mismatches += batches.size() != serial.batches[RenderGraph::QA_GRAPHICS].size();
+		for (size_t i = 0; i < std::min(batches.size(), serial.batches[RenderGraph::QA_GRAPHICS].size()); ++i)
+			mismatches += batches[i].barriers.size() != serial.batches[RenderGraph::QA_GRAPHICS][i].barriers.size();
+	}
+	EXPECT(mismatches == 0);
+	EXPECT(numSetups == 21 * NUM_PASSES);
+	EXPECT(serial.numCulled < NUM_PASSES);
+}
+
+#include "HeapAllocator.h"
+
+// placement of the heap allocator: alignment, exhaustion, merging of freed neighbours,
+// and random allocations checked against a map of the live ranges
+void heapAllocatorTest()
+{
+	static const uint64_t GRANULARITY = 4096;
+	static const uint64_t ALIGNMENT = 65536;
+	static const uint64_t SIZE = 64ull << 20;
+
+	// the whole heap in one piece, then nothing fits
+	{
+		HeapAllocator heap(SIZE, GRANULARITY);
+		EXPECT(heap.alloc(SIZE + 1) == HeapAllocator::INVALID_OFFSET);
+		auto offset = heap.alloc(SIZE);
+		EXPECT(offset == 0);
+		EXPECT(heap.alloc(1) == HeapAllocator::INVALID_OFFSET);
+		heap.free(offset);
+		EXPECT(heap.empty());
+	}
+
+	// sizes are rounded up to the granularity, the padding in front of an aligned range stays free
+	{
+		HeapAllocator heap(SIZE, GRANULARITY);
+		auto small = heap.alloc(1);
+		auto aligned = heap.alloc(GRANULARITY, ALIGNMENT);
+		EXPECT(small == 0);
+		EXPECT(aligned == ALIGNMENT);
+		EXPECT(heap.getUsed() == 2 * GRANULARITY);
+		EXPECT(heap.alloc(ALIGNMENT - GRANULARITY) == GRANULARITY);
+		heap.free(small);
+		heap.free(aligned);
+	}
+
+	// freed ranges merge with their free neighbours
+	{
+		HeapAllocator heap(SIZE, GRANULARITY);
+		auto a = heap.alloc(GRANULARITY);
+		auto b = heap.alloc(GRANULARITY);
+		auto c = heap.alloc(GRANULARITY);
+		heap.free(a);
+		heap.free(c);
+		EXPECT(heap.getStats().freeRanges == 2);
+		heap.free(b);
+		auto stats = heap.getStats();
+		EXPECT(stats.freeRanges == 1);
+		EXPECT(stats.largestFree == SIZE);
+	}
+
+	std::mt19937_64 rng(1);
+	HeapAllocator heap(SIZE, GRANULARITY);
+	// offset to size of the live ranges
+	std::map<uint64_t, uint64_t> live;
+	uint64_t used = 0;
+	size_t misplaced = 0;
+	size_t miscounted = 0;
+	for (size_t i = 0; i < 100000; ++i)
+	{
+		if (live.empty() || rng() % 100 < 55)
+		{
+			auto size = rng() % 4 == 0 ? rng() % (4 << 20) + 1 : rng() % 200000 + 1;
+			auto alignment = rng() % 2 ? ALIGNMENT : GRANULARITY;
+			auto offset = heap.alloc(size, alignment);
+			if (offset == HeapAllocator::INVALID_OFFSET)
+				continue;
+
+			size = (size + GRANULARITY - 1) & ~(GRANULARITY - 1);
+			auto next = live.upper_bound(offset);
+			misplaced += offset % alignment != 0 || offset + size > SIZE;
+			misplaced += next != live.end() && offset + size > next->first;
+			misplaced += next != live.begin() && std::prev(next)->first + std::prev(next)->second > offset;
+			live[offset] = size;
+			used += size;
+		}
+		else
+		{
+			auto range = std::next(live.begin(), rng() % live.size());
+			heap.free(range->first);
+			used -= range->second;
+			live.erase(range);
+		}
+		miscounted += heap.getUsed() != used;
+	}
+	EXPECT(misplaced == 0);
+	EXPECT(miscounted == 0);
+
+	for (auto& [offset, size] : live)
+		heap.free(offset);
+	auto stats = heap.getStats();
+	EXPECT(stats.usedBytes == 0 && stats.allocations == 0);
+	EXPECT(stats.freeRanges == 1 && stats.largestFree == SIZE);
+}
+
+int main()
+{
+	hazardValidatorTest();
+	commandListRingTest();
+	{
+		TestWorkers workers;
+		waitTest();
+		awaitTest();
+		taskGraphTest();
+		priorityLaneTest();
+		renderGraphCompileTest();
+		barrierPlanTest();
+		parallelSetupTest();
+	}
+	heapAllocatorTest();
+
+	if (failures != 0)
+		printf("%d checks failed\n", failures);
+	else
+		printf("all checks passed\n");
+	return failures != 0;
+}
+
+#endif
+
+
+#if defined(_DEVICE_TEST)
+
+// tests that need a window and a d3d12 device, kept out of the tests that run everywhere
+#include "Framework.h"
+#include "ResourceViewAllocator.h"
+#include <cstdio>
+#include <limits>
+
+static int failures = 0;
+#define EXPECT(x) do { if (!(x)) { printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+// the view pool over real frames: a recycled view is only handed out again once the gpu finished the frame
+// it was recycled in, the latest recycled one first, and trim() evicts the least recently recycled views
+class ViewPoolTest : public Framework
+{
+private:
+	static const size_t MAX_WAIT_FRAMES = 100;
+	static const size_t UNLIMITED = std::numeric_limits<size_t>::max();
+
+	Renderer::Resource::Ref alloc(UINT width)
+	{
+		return ResourceViewAllocator::Singleton.alloc(width, 8, 1, DXGI_FORMAT_R8G8B8A8_UNORM, Renderer::VT_RENDERTARGET, {}).first;
+	}
+
+	void recycle(const Renderer::Resource::Ref& view)
+	{
+		ResourceViewAllocator::Singleton.recycle(view);
+		mFrame = Renderer::getSingleton()->getFrameNumber();
+	}
+
+	void updateImpl() override
+	{
+		auto& pool = ResourceViewAllocator::Singleton;
+		// every step after the first needs the gpu to be done with the views recycled by the one before
+		if (mStep != 0 && Renderer::getSingleton()->getCompletedFrame() <= mFrame)
+		{
+			if (++mWaited < MAX_WAIT_FRAMES)
+				return;
+			EXPECT(mWaited < MAX_WAIT_FRAMES);
+			PostQuitMessage(1);
+			return;
+		}
+		mWaited = 0;
+
+		switch (mStep++)
+		{
+		case 0:
+		{
+			// start from an empty pool, so that no other view is evicted first
+			pool.setBudget(0);
+			pool.trim();
+			pool.setBudget(UNLIMITED);
+
+			mFirst = alloc(40);
+			recycle(mFirst);
+			auto stats = pool.getStats();
+			mSecond = alloc(40);
+			EXPECT(!(mSecond == mFirst));
+			EXPECT(pool.getStats().inFlight == stats.inFlight + 1);
+			recycle(mSecond);
+			break;
+		}
+		case 1:
+		{
+			auto stats = pool.getStats();
+			auto view = alloc(40);
+			EXPECT(view == mSecond);
+			EXPECT(pool.getStats().reused == stats.reused + 1);
+			recycle(view);
+			mOther = alloc(48);
+			recycle(mOther);
+
+			// the first view is the least recently recycled one now
+			stats = pool.getStats();
+			EXPECT(stats.pooledViews == 3);
+			pool.setBudget(stats.pooledBytes - 1);
+			pool.trim();
+			pool.setBudget(UNLIMITED);
+			auto trimmed = pool.getStats();
+			EXPECT(trimmed.evicted == stats.evicted + 1);
+			EXPECT(trimmed.pooledViews == 2);
+			break;
+		}
+		case 2:
+		{
+			auto stats = pool.getStats();
+			EXPECT(alloc(48) == mOther);
+			EXPECT(alloc(40) == mSecond);
+			// the first one is gone, so this one is created
+			alloc(40);
+			auto after = pool.getStats();
+			EXPECT(after.reused == stats.reused + 2);
+			EXPECT(after.created == stats.created + 1);
+			EXPECT(after.pooledViews == 0);
+			PostQuitMessage(0);
+			break;
+		}
+		}
+	}
+
+	size_t mStep = 0;
+	size_t mWaited = 0;
+	UINT64 mFrame = 0;
+	Renderer::Resource::Ref mFirst;
+	Renderer::Resource::Ref mSecond;
+	Renderer::Resource::Ref mOther;
+};
+
+int main()
+{
+	{
+		// starts workers of its own and the renderer
+		ViewPoolTest test;
+		test.initialize();
+		test.update();
+	}
+
+	if (failures != 0)
+		printf("%d checks failed\n", failures);
+	else
+		printf("all checks passed\n");
+	return failures != 0;
+}
+
+#endif
+
+#if defined(_BENCHMARK)
+
+#include "Dispatcher.h"
+#include "HeapAllocator.h"
+#include "RenderGraph.h"
+#include "TaskExecutor.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <thread>
+
+// allocations of the calling thread, counted by the replaced global operator new
+static thread_local size_t numAllocations = 0;
+
+void* operator new(size_t size)
+{
+	numAllocations++;
+	if (auto ptr = malloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+// time until numChains chains of length jobs ran, every job posts the next one of its chain,
+// so most jobs are posted by the threads that run them
+template<class Post>
+float measureChains(size_t numChains, size_t length, const Post& post)
+{
+	struct Link
+	{
+		const Post* post;
+		std::atomic<size_t>* done;
+		size_t remaining;
+
+		void operator()()const
+		{
+			done->fetch_add(1, std::memory_order_relaxed);
+			if (remaining > 1)
+				(*post)(Link{ post, done, remaining - 1 });
+		}
+	};
+
+	std::atomic<size_t> done = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < numChains; ++i)
+		post(Link{ &post, &done, length });
+	while (done.load(std::memory_order_relaxed) < numChains * length)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// throughput of small jobs on the work-stealing scheduler and, where there is asio, on an asio context run by as many threads
+void schedulerBenchmark()
+{
+	static const size_t NUM_JOBS = 1000000;
+
+	auto numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	auto numChains = numThreads * 4;
+	auto length = NUM_JOBS / numChains;
+
+	float schedulerTime = 0;
+	{
+		Scheduler scheduler(numThreads);
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < numThreads; ++i)
+			threads.emplace_back([&scheduler, i]() { scheduler.run(i); });
+		schedulerTime = measureChains(numChains, length, [&](auto&& job) {
+			scheduler.post(std::move(job));
+		});
+		scheduler.stop();
+		for (auto& t : threads)
+			t.join();
+	}
+	printf("%zu jobs on %zu threads: scheduler %.3f ms\n", numChains * length, numThreads, schedulerTime);
+
+#if !defined(_HEADLESS)
+	float asioTime = 0;
+	{
+		asio::io_context context;
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < numThreads; ++i)
+			threads.emplace_back([&context]() { Dispatcher::run(context); });
+		asioTime = measureChains(numChains, length, [&](auto&& job) {
+			asio::post(context, std::move(job));
+		});
+		context.stop();
+		for (auto& t : threads)
+			t.join();
+	}
+
+	printf("%zu jobs on %zu threads: asio %.3f ms\n", numChains * length, numThreads, asioTime);
+#endif
+}
+
+// parallel_for and parallel_reduce over the same array with 1 up to hardware_concurrency threads.
+// the caller helps in the wait, so n threads are n - 1 workers of the shared scheduler and the caller
+void parallelForBenchmark()
+{
+	static const size_t NUM_ELEMENTS = 1 << 22;
+	static const size_t NUM_ROUNDS = 10;
+
+	auto maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	std::vector<size_t> counts;
+	for (size_t n = 1; n < maxThreads; n *= 2)
+		counts.push_back(n);
+	counts.push_back(maxThreads);
+
+	std::vector<float> values(NUM_ELEMENTS);
+	float serialTime = 0;
+	for (auto numThreads : counts)
+	{
+		Dispatcher::enableWorkStealing(numThreads - 1);
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; ++i)
+			threads.emplace_back([i]() { Dispatcher::runWorker(i - 1); });
+
+		double sum = 0;
+		float time = 0;
+		{
+			TaskExecutor executor(Dispatcher::getSharedContext());
+			auto start = std::chrono::high_resolution_clock::now();
+			for (size_t round = 0; round < NUM_ROUNDS; ++round)
+			{
+				executor.parallel_for(0, NUM_ELEMENTS, 0, [&](size_t i) {
+					values[i] = std::sin((float)(i + round));
+				});
+				sum += executor.parallel_reduce(0, NUM_ELEMENTS, 0, 0.0, [&](size_t i) {
+					return (double)values[i];
+				}, std::plus<double>());
+			}
+			time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		Dispatcher::stop(Dispatcher::getSharedContext());
+		for (auto& t : threads)
+			t.join();
+
+		if (numThreads == 1)
+			serialTime = time;
+		printf("parallel_for and parallel_reduce on %zu threads: %.3f ms, %.2fx, sum %.3f\n", numThreads, time, serialTime / time, sum);
+	}
+}
+
+template<class Signature>
+using StdFunction = std::function<Signature>;
+template<class Signature>
+using MoveOnlyFunction = UniqueFunction<Signature>;
+
+// allocations to store the setups of passes shaped like the scene pass and the tasks they return,
+// both capture the scene callback, two handles and the flags
+template<template<class> class Function>
+void storePasses(const std::string& name, const std::vector<ResourceHandle::Ptr>& handles)
+{
+	static const size_t NUM_PASSES = 100000;
+	using Task = Function<void(Renderer::CommandList*)>;
+	using Setup = Function<Task()>;
+
+	auto scene = std::make_shared<std::function<void(Renderer::CommandList*)>>([](Renderer::CommandList*) {});
+	std::vector<Setup> setups;
+	std::vector<Task> tasks;
+	setups.reserve(NUM_PASSES);
+	tasks.reserve(NUM_PASSES);
+
+	auto allocations = numAllocations;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < NUM_PASSES; ++i)
+	{
+		auto& rt = handles[i % handles.size()];
+		auto& ds = handles[(i + 1) % handles.size()];
+		setups.emplace_back([scene, rt, ds, flags = i]() -> Task {
+			return [scene, rt, ds, flags](Renderer::CommandList* cmdlist) {
+				(*scene)(cmdlist);
+			};
+		});
+	}
+	for (auto& setup : setups)
+		tasks.push_back(setup());
+	auto time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("%s: %.2f allocations per pass, %zu passes in %.3f ms\n", name.c_str(), (double)(numAllocations - allocations) / NUM_PASSES, NUM_PASSES, time);
+}
+
+// the callables of the task and command paths were std::function before UniqueFunction
+void functionBenchmark()
+{
+	std::vector<ResourceHandle::Ptr> handles;
+	for (size_t i = 0; i < 4; ++i)
+		handles.push_back(ResourceHandle::create(Renderer::VT_RENDERTARGET, 256, 256, DXGI_FORMAT_R8G8B8A8_UNORM, {}));
+
+	storePasses<StdFunction>("std::function", handles);
+	storePasses<MoveOnlyFunction>("UniqueFunction", handles);
+}
+
+// placement policy of the resource heaps under a random mix of small textures and 64kb aligned resources,
+// kept around 75% full. sizes are the ones of Renderer::HeapManager and the d3d12 placement alignments
+void heapAllocatorBenchmark()
+{
+	static const size_t NUM_OPERATIONS = 1000000;
+	static const uint64_t HEAP_SIZE = 64 * 1024 * 1024;
+	static const uint64_t SMALL_ALIGNMENT = 4096;
+	static const uint64_t DEFAULT_ALIGNMENT = 65536;
+
+	std::mt19937 rng(1);
+	HeapAllocator heap(HEAP_SIZE, SMALL_ALIGNMENT);
+	std::vector<uint64_t> live;
+	size_t failed = 0;
+	double fragmentation = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < NUM_OPERATIONS; ++i)
+	{
+		if (live.empty() || heap.getUsed() < heap.getSize() * 3 / 4)
+		{
+			auto small = rng() % 2 == 0;
+			auto size = small ? (rng() % 16 + 1) * SMALL_ALIGNMENT : (rng() % 64 + 1) * DEFAULT_ALIGNMENT;
+			auto offset = heap.alloc(size, small ? SMALL_ALIGNMENT : DEFAULT_ALIGNMENT);
+			if (offset == HeapAllocator::INVALID_OFFSET)
+				failed++;
+			else
+				live.push_back(offset);
+		}
+		else
+		{
+			auto index = rng() % live.size();
+			heap.free(live[index]);
+			live[index] = live.back();
+			live.pop_back();
+		}
+
+		if (i % 1000 == 0)
+		{
+			// share of the free bytes that is not in the largest free range
+			auto stats = heap.getStats();
+			auto free = stats.size - stats.usedBytes;
+			fragmentation += free ? 1.0 - (double)stats.largestFree / free : 0;
+		}
+	}
+	auto time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("heap allocator: %zu operations in %.3f ms, %zu failed, average fragmentation %.1f%%\n", NUM_OPERATIONS, time, failed, fragmentation * 100.0 / (NUM_OPERATIONS / 1000));
+}
+
+// cost of the setups of 500 synthetic passes with serial and parallel setup
+bool setupBenchmark()
+{
+	static const size_t NUM_PASSES = 500;
+	static const size_t NUM_FRAMES = 100;
+
+	auto numWorkers = std::max<size_t>(std::thread::hardware_concurrency(), 2) - 1;
+	Dispatcher::enableWorkStealing(numWorkers);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < numWorkers; ++i)
+		threads.emplace_back([i]() { Dispatcher::runWorker(i); });
+
+	std::vector<ResourceHandle::Ptr> handles;
+	for (size_t i = 0; i < 16; ++i)
+	{
+		auto handle = ResourceHandle::create(Renderer::VT_RENDERTARGET, 256, 256, DXGI_FORMAT_R8G8B8A8_UNORM, {});
+		handle->setImported(true);
+		handles.push_back(handle);
+	}
+
+	auto failed = false;
+	float serialTime = 0;
+	float parallelTime = 0;
+	{
+		RenderGraph graph;
+		auto measure = [&](bool parallel, size_t& hash) {
+			graph.setParallelSetup(parallel);
+			for (size_t i = 0; i < NUM_PASSES; ++i)
+			{
+				graph.addPass("pass " + std::to_string(i), [&handles, i](RenderGraph::Builder& builder)->RenderGraph::RenderTask {
+					// stands in for culling or building draw lists
+					size_t work = i;
+					for (size_t n = 0; n < 20000; ++n)
+						work ^= std::hash<size_t>()(n) + 0x9e3779b9 + (work << 6) + (work >> 2);
+					builder.read(handles[(i + work % 2) % handles.size()]);
+					builder.write(handles[(i + 1) % handles.size()], RenderGraph::Builder::IT_NONE);
+					return {};
+				});
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			hash = graph.compile(false).structureHash;
+			auto time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			graph.reset();
+			return time;
+		};
+
+		for (size_t frame = 0; frame < NUM_FRAMES && !failed; ++frame)
+		{
+			size_t serialHash = 0;
+			size_t parallelHash = 0;
+			serialTime += measure(false, serialHash);
+			parallelTime += measure(true, parallelHash);
+			// checked in release builds too, a benchmark of another graph means nothing
+			failed = serialHash != parallelHash;
+		}
+	}
+	Dispatcher::stop(Dispatcher::getSharedContext());
+	for (auto& t : threads)
+		t.join();
+
+	if (failed)
+		printf("parallel setup compiled another graph\n");
+	else
+		printf("%zu passes on %zu workers, serial setup %.3f ms, parallel setup %.3f ms\n", NUM_PASSES, numWorkers, serialTime / NUM_FRAMES, parallelTime / NUM_FRAMES);
+	return !failed;
+}
+
+int main()
+{
+	schedulerBenchmark();
+	functionBenchmark();
+	parallelForBenchmark();
+	heapAllocatorBenchmark();
+	return setupBenchmark() ? 0 : 1;
+}
+
+#endif